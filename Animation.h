@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Mid
+{
+	// One timesampled SkelAnimation attribute as a track per joint. USD stores a sample per
+	// time holding every joint's value; glTF wants a sampler per joint, so the samples are
+	// transposed once instead of walking them again for every joint.
+	template<typename T>
+	struct JointTracks
+	{
+		std::vector<float> times;	// seconds, shared by every joint
+		std::vector<T> values;		// joint-major: the track of joint i starts at i * times.size()
+		size_t num_joints = 0;
+
+		const T* Track(size_t joint) const
+		{
+			return values.data() + joint * times.size();
+		}
+	};
+
+	// The keys of one animation channel as written to glTF.
+	template<typename T>
+	struct KeyTrack
+	{
+		std::vector<float> times;
+		std::vector<T> values;
+		bool step = false;		// hold each key until the next one instead of interpolating
+	};
+
+	// Picks the keys of a track to keep, in order: fits(a, b, i) tells whether key i is
+	// reproduced within tolerance by the kept keys a and b around it. Segments are grown
+	// greedily from each kept key, checking every key they skip, and are cut at max_span keys
+	// to bound the cost of long flat runs. The first and last keys are always kept.
+	template<typename Fits>
+	inline void ReduceKeys(size_t count, Fits fits, std::vector<size_t>& keys_out, size_t max_span = 256)
+	{
+		keys_out.clear();
+		if (count == 0) return;
+		keys_out.push_back(0);
+		size_t a = 0;
+		size_t b = 1;
+		while (b < count)
+		{
+			size_t c = b + 1;
+			bool extend = c < count && c - a <= max_span;
+			for (size_t i = a + 1; extend && i < c; i++)
+			{
+				extend = fits(a, c, i);
+			}
+			if (extend)
+			{
+				b = c;
+			}
+			else
+			{
+				keys_out.push_back(b);
+				a = b;
+				b = a + 1;
+			}
+		}
+	}
+
+	// Fills tracks from samples with .t (in time codes) and .value (one entry per joint),
+	// converting values with convert(value) -> T. Joints missing from a sample keep fill.
+	template<typename T, typename Sample, typename Convert>
+	inline void TransposeJointSamples(const std::vector<Sample>& samples, size_t num_joints, double time_codes_per_sec, T fill, Convert convert, JointTracks<T>& tracks_out)
+	{
+		size_t num_times = samples.size();
+		tracks_out.num_joints = num_joints;
+		tracks_out.times.resize(num_times);
+		tracks_out.values.assign(num_times * num_joints, fill);
+		for (size_t j = 0; j < num_times; j++)
+		{
+			const Sample& sample = samples[j];
+			tracks_out.times[j] = (float)(sample.t / time_codes_per_sec);
+			size_t count = sample.value.size() < num_joints ? sample.value.size() : num_joints;
+			T* p_out = tracks_out.values.data() + j;
+			for (size_t i = 0; i < count; i++)
+			{
+				p_out[i * num_times] = convert(sample.value[i]);
+			}
+		}
+	}
+
+	// Times from t0 to t1 at fps frames per second. The last one is t1, closer to the one
+	// before when the range isn't a whole number of frames.
+	inline std::vector<float> UniformTimes(float t0, float t1, float fps)
+	{
+		std::vector<float> times;
+		// Frames less than a thousandth of a frame short of t1 are merged into it, so the times
+		// stay strictly increasing.
+		double num_frames = (double)(t1 - t0) * fps;
+		size_t count = (size_t)std::ceil(num_frames - 1e-3) + 1;
+		times.resize(count);
+		for (size_t k = 0; k + 1 < count; k++)
+		{
+			times[k] = (float)(t0 + k / (double)fps);
+		}
+		times[count - 1] = t1;
+		return times;
+	}
+
+	// Calls eval(k, a, b, f) for every time k of times_out (increasing) with the keys a and
+	// b = a + 1 of times around it and the fraction f from a to b. Before the first key and
+	// after the last one, a and b are both that key.
+	template<typename Eval>
+	inline void ResampleKeys(const std::vector<float>& times, const std::vector<float>& times_out, Eval eval)
+	{
+		size_t count = times.size();
+		if (count == 0) return;
+		size_t a = 0;
+		for (size_t k = 0; k < times_out.size(); k++)
+		{
+			float t = times_out[k];
+			while (a + 1 < count && times[a + 1] <= t) a++;
+			if (t <= times[a] || a + 1 == count)
+			{
+				eval(k, a, a, 0.0f);
+			}
+			else
+			{
+				eval(k, a, a + 1, (t - times[a]) / (times[a + 1] - times[a]));
+			}
+		}
+	}
+
+	// Evaluates the track given by times and values at every time of times_out, interpolating
+	// with lerp(a, b, f).
+	template<typename T, typename Lerp>
+	inline void ResampleTrack(const std::vector<float>& times, const T* values, const std::vector<float>& times_out, Lerp lerp, std::vector<T>& values_out)
+	{
+		values_out.resize(times_out.size());
+		ResampleKeys(times, times_out, [&](size_t k, size_t a, size_t b, float f)
+			{
+				values_out[k] = a == b ? values[a] : lerp(values[a], values[b], f);
+			});
+	}
+
+	// Keyframe time arrays already written for one animation and their accessors, found by
+	// content so that samplers with the same input share one accessor.
+	class TimeAccessorCache
+	{
+	public:
+		// Accessor holding exactly these times, -1 if there is none yet.
+		int Find(const float* times, size_t count) const
+		{
+			auto iter = entries.find(Hash(times, count));
+			if (iter == entries.end()) return -1;
+			for (const Entry& entry : iter->second)
+			{
+				if (entry.times.size() == count && memcmp(entry.times.data(), times, count * sizeof(float)) == 0) return entry.acc_id;
+			}
+			return -1;
+		}
+
+		void Insert(const float* times, size_t count, int acc_id)
+		{
+			entries[Hash(times, count)].push_back({ std::vector<float>(times, times + count), acc_id });
+		}
+
+	private:
+		struct Entry
+		{
+			std::vector<float> times;
+			int acc_id;
+		};
+
+		static size_t Hash(const float* times, size_t count)
+		{
+			return std::hash<std::string_view>()(std::string_view((const char*)times, count * sizeof(float)));
+		}
+
+		std::unordered_map<size_t, std::vector<Entry>> entries;
+	};
+}
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#define GLB_FSEEK _fseeki64
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define GLB_FSEEK fseeko
+#endif
+
+namespace Mid
+{
+	// Buffer data laid out before it is written. Every region gets its final offset when it is
+	// added and is allocated at its exact size without being cleared, so the payload is never
+	// grown, reallocated or zero-filled. Offsets are 4 byte aligned, the gaps between regions
+	// are zero padding.
+	class BufferPlan
+	{
+	public:
+		struct Region
+		{
+			size_t offset;
+			size_t size;
+			std::unique_ptr<uint8_t[]> data;
+		};
+
+		std::vector<Region> regions;
+
+		// Adds an uninitialized region of size bytes, to be filled by the caller through the
+		// returned pointer, and stores its offset in *offset.
+		uint8_t* Reserve(size_t size, size_t* offset)
+		{
+			Region region;
+			region.offset = (size_total + 3) / 4 * 4;
+			region.size = size;
+			region.data.reset(new uint8_t[size > 0 ? size : 1]);
+			size_total = region.offset + size;
+			*offset = region.offset;
+			regions.push_back(std::move(region));
+			return regions.back().data.get();
+		}
+
+		size_t Add(const void* data, size_t size)
+		{
+			size_t offset;
+			memcpy(Reserve(size, &offset), data, size);
+			return offset;
+		}
+
+		// Takes over data, an allocation of size bytes, without copying it.
+		size_t Add(std::unique_ptr<uint8_t[]> data, size_t size)
+		{
+			Region region;
+			region.offset = (size_total + 3) / 4 * 4;
+			region.size = size;
+			region.data = std::move(data);
+			size_total = region.offset + size;
+			regions.push_back(std::move(region));
+			return regions.back().offset;
+		}
+
+		// Moves the regions of plan behind the ones already added, keeping their layout.
+		// Returns the offset plan starts at.
+		size_t Add(BufferPlan&& plan)
+		{
+			size_t base = (size_total + 3) / 4 * 4;
+			for (size_t i = 0; i < plan.regions.size(); i++)
+			{
+				plan.regions[i].offset += base;
+				regions.push_back(std::move(plan.regions[i]));
+			}
+			if (plan.size_total > 0) size_total = base + plan.size_total;
+			plan.regions.clear();
+			plan.size_total = 0;
+			return base;
+		}
+
+		size_t Size() const
+		{
+			return size_total;
+		}
+
+		// Copies the regions to dst + offset in parallel, zeroing the padding in front of each.
+		void CopyTo(uint8_t* dst, unsigned max_threads) const
+		{
+			ThreadPool::Shared().ParallelFor(regions.size(), [&](size_t i)
+				{
+					const Region& region = regions[i];
+					size_t start = i > 0 ? regions[i - 1].offset + regions[i - 1].size : 0;
+					memset(dst + start, 0, region.offset - start);
+					memcpy(dst + region.offset, region.data.get(), region.size);
+				}, max_threads);
+		}
+
+		// Writes the regions in order, starting at BIN offset *written, freeing each one as
+		// soon as it is written.
+		bool Write(FILE* fp, size_t* written)
+		{
+			static const uint8_t zeros[4] = { 0, 0, 0, 0 };
+			bool ok = true;
+			for (size_t i = 0; i < regions.size(); i++)
+			{
+				Region& region = regions[i];
+				size_t pad = region.offset - *written;
+				if (pad > 0 && fwrite(zeros, 1, pad, fp) != pad) ok = false;
+				if (region.size > 0 && fwrite(region.data.get(), 1, region.size, fp) != region.size) ok = false;
+				*written = region.offset + region.size;
+				region.data.reset();
+			}
+			regions.clear();
+			return ok;
+		}
+
+	private:
+		size_t size_total = 0;
+	};
+
+	// Writes a binary glTF from a BufferPlan. To a file, the plan is buffered up to
+	// buffer_limit and then streamed behind space reserved for the header and JSON chunk;
+	// Finish() writes the JSON into that space, moving the BIN chunk up if the reservation was
+	// too small. Outputs that can't seek (pipes, sockets) keep the whole plan until Finish()
+	// and then write the glb front to back, freeing each region once it is out. In memory
+	// mode the glb is allocated once at its exact size when the JSON is known and the regions
+	// are copied into it in parallel.
+	class GlbWriter
+	{
+	public:
+		size_t buffer_limit = (size_t)16 << 20;
+		unsigned num_threads = 0;
+
+		~GlbWriter()
+		{
+			if (fp != nullptr && owns_fp) fclose(fp);
+			free(memory);
+		}
+
+		bool Open(const char* filename)
+		{
+			fp = fopen(filename, "wb+");
+			owns_fp = true;
+			return fp != nullptr;
+		}
+
+		// fp must be positioned at the start of the output, and open for reading and writing
+		// unless it can't seek.
+		bool Open(FILE* file)
+		{
+			fp = file;
+			owns_fp = false;
+			seekable = fp != nullptr && GLB_FSEEK(fp, 0, SEEK_CUR) == 0;
+			return fp != nullptr;
+		}
+
+#ifndef _WIN32
+		bool OpenFd(int fd)
+		{
+			int fd_dup = dup(fd);
+			if (fd_dup < 0) return false;
+			// Write-only descriptors (the write end of a pipe) can't be opened for update.
+			bool write_only = (fcntl(fd_dup, F_GETFL) & O_ACCMODE) == O_WRONLY;
+			fp = fdopen(fd_dup, write_only ? "wb" : "wb+");
+			if (fp == nullptr) close(fd_dup);
+			owns_fp = true;
+			seekable = fp != nullptr && GLB_FSEEK(fp, 0, SEEK_CUR) == 0;
+			return fp != nullptr;
+		}
+#endif
+
+		void OpenMemory()
+		{
+			memory_mode = true;
+		}
+
+		// Hands the glb built in memory mode to the caller, who releases it with free().
+		unsigned char* Release(size_t* size)
+		{
+			unsigned char* data = memory;
+			*size = memory_size;
+			memory = nullptr;
+			memory_size = 0;
+			return data;
+		}
+
+		// Same as BufferPlan::Reserve(), with offsets into the BIN chunk. The region must be
+		// filled before the next call on the writer.
+		uint8_t* Reserve(size_t size, size_t* offset)
+		{
+			Flush();
+			return plan.Reserve(size, offset);
+		}
+
+		size_t Add(const void* data, size_t size)
+		{
+			Flush();
+			return plan.Add(data, size);
+		}
+
+		size_t Add(BufferPlan&& part)
+		{
+			Flush();
+			return plan.Add(std::move(part));
+		}
+
+		size_t Size() const
+		{
+			return (plan.Size() + 3) / 4 * 4;
+		}
+
+		// Size of the glb Finish(json) writes, unless the output has started streaming and
+		// reserved space for a different JSON size.
+		size_t GlbSize(const std::string& json) const
+		{
+			return header_size + (json.size() + 3) / 4 * 4 + bin_header_size + Size();
+		}
+
+		bool Finish(const std::string& json)
+		{
+			size_t json_size = (json.size() + 3) / 4 * 4;
+			if (memory_mode)
+			{
+				std::vector<uint8_t> head;
+				WriteHeader(head, json, json_size);
+				memory_size = head.size() + Size();
+				memory = (unsigned char*)malloc(memory_size);
+				if (memory == nullptr) return false;
+				memcpy(memory, head.data(), head.size());
+				plan.CopyTo(memory + head.size(), num_threads);
+				memset(memory + head.size() + plan.Size(), 0, Size() - plan.Size());
+				return !failed;
+			}
+
+			if (fp == nullptr) return false;
+
+			if (!streaming)
+			{
+				std::vector<uint8_t> head;
+				WriteHeader(head, json, json_size);
+				if (fwrite(head.data(), 1, head.size(), fp) != head.size()) failed = true;
+				if (!plan.Write(fp, &written)) failed = true;
+				WritePadding();
+			}
+			else
+			{
+				if (!plan.Write(fp, &written)) failed = true;
+				WritePadding();
+				if (json_size > json_reserve)
+				{
+					Shift(json_size - json_reserve);
+					json_reserve = json_size;
+				}
+				std::vector<uint8_t> head;
+				WriteHeader(head, json, json_reserve);
+				if (GLB_FSEEK(fp, 0, SEEK_SET) != 0) failed = true;
+				if (fwrite(head.data(), 1, head.size(), fp) != head.size()) failed = true;
+			}
+
+			if (fflush(fp) != 0) failed = true;
+			return !failed;
+		}
+
+	private:
+		static const size_t header_size = 12 + 8;
+		static const size_t bin_header_size = 8;
+
+		// Writes out the regions added so far once the output is streamed, or starts streaming
+		// when buffer_limit is reached.
+		void Flush()
+		{
+			if (fp == nullptr || memory_mode) return;
+			if (streaming)
+			{
+				if (!plan.Write(fp, &written)) failed = true;
+			}
+			else if (seekable && plan.Size() >= buffer_limit)
+			{
+				Stream();
+			}
+		}
+
+		// Switches from buffering to writing straight to the file. The JSON isn't known yet,
+		// so space for it is reserved from the size of the buffered data.
+		void Stream()
+		{
+			json_reserve = (plan.Size() / 16 + 3) / 4 * 4;
+			if (GLB_FSEEK(fp, (int64_t)(header_size + json_reserve + bin_header_size), SEEK_SET) != 0) failed = true;
+			if (!plan.Write(fp, &written)) failed = true;
+			streaming = true;
+		}
+
+		void WritePadding()
+		{
+			static const uint8_t zeros[4] = { 0, 0, 0, 0 };
+			size_t pad = Size() - written;
+			if (pad > 0 && fwrite(zeros, 1, pad, fp) != pad) failed = true;
+			written += pad;
+		}
+
+		// Moves the BIN chunk delta bytes towards the end of the file, last block first.
+		void Shift(size_t delta)
+		{
+			size_t start = header_size + json_reserve + bin_header_size;
+			std::vector<uint8_t> block((size_t)1 << 20);
+			size_t pos = written;
+			while (pos > 0 && !failed)
+			{
+				size_t n = pos < block.size() ? pos : block.size();
+				pos -= n;
+				if (GLB_FSEEK(fp, (int64_t)(start + pos), SEEK_SET) != 0) failed = true;
+				if (fread(block.data(), 1, n, fp) != n) failed = true;
+				if (GLB_FSEEK(fp, (int64_t)(start + pos + delta), SEEK_SET) != 0) failed = true;
+				if (fwrite(block.data(), 1, n, fp) != n) failed = true;
+			}
+		}
+
+		void WriteHeader(std::vector<uint8_t>& head, const std::string& json, size_t json_chunk_size)
+		{
+			uint64_t total = header_size + json_chunk_size + bin_header_size + Size();
+			if (total > 0xffffffffull) failed = true;
+
+			head.reserve(header_size + json_chunk_size + bin_header_size);
+			PutU32(head, 0x46546C67);	// "glTF"
+			PutU32(head, 2);
+			PutU32(head, (uint32_t)total);
+			PutU32(head, (uint32_t)json_chunk_size);
+			PutU32(head, 0x4E4F534A);	// "JSON"
+			head.insert(head.end(), json.begin(), json.end());
+			head.resize(header_size + json_chunk_size, ' ');
+			PutU32(head, (uint32_t)Size());
+			PutU32(head, 0x004E4942);	// "BIN"
+		}
+
+		static void PutU32(std::vector<uint8_t>& out, uint32_t v)
+		{
+			out.push_back((uint8_t)(v & 0xff));
+			out.push_back((uint8_t)((v >> 8) & 0xff));
+			out.push_back((uint8_t)((v >> 16) & 0xff));
+			out.push_back((uint8_t)((v >> 24) & 0xff));
+		}
+
+		BufferPlan plan;
+
+		FILE* fp = nullptr;
+		bool owns_fp = false;
+		bool seekable = true;
+		bool streaming = false;
+		size_t json_reserve = 0;
+		size_t written = 0;
+
+		bool memory_mode = false;
+		unsigned char* memory = nullptr;
+		size_t memory_size = 0;
+
+		bool failed = false;
+	};
+}
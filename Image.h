@@ -24,6 +24,7 @@ namespace Mid
 		void Set(int x, int y, const glm::u8vec4& v);
 
 		void Load(const char* fn);
+		void Load(const char* fn, const uint8_t* data, size_t size);
 
 		void encode_png()
 		{
@@ -108,6 +109,20 @@ namespace Mid
 	}
 
 	void Image::Load(const char* fn)
+	{
+		FILE* fp = fopen(fn, "rb");
+		if (fp == nullptr) return;
+		fseek(fp, 0, SEEK_END);
+		size_t size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		std::vector<uint8_t> data(size);
+		fread(data.data(), 1, size, fp);
+		fclose(fp);
+
+		Load(fn, data.data(), size);
+	}
+
+	void Image::Load(const char* fn, const uint8_t* data, size_t size)
 	{
 		std::string filename = fn;
 		std::string ext = filename.substr(filename.find_last_of(".") + 1);
@@ -117,20 +132,15 @@ namespace Mid
 			this->mimeType = "image/png";
 		}
 		int width, height, chn;
-		uint8_t* data = stbi_load(fn, &width, &height, &chn, 4);
+		uint8_t* decoded = stbi_load_from_memory(data, (int)size, &width, &height, &chn, 4);
+		if (decoded == nullptr) return;
 		this->width = width;
 		this->height = height;
 		this->pixels.resize(width * height * 4);
-		memcpy(this->pixels.data(), data, width * height * 4);
-		stbi_image_free(data);
+		memcpy(this->pixels.data(), decoded, width * height * 4);
+		stbi_image_free(decoded);
 
-		FILE* fp = fopen(fn, "rb");
-		fseek(fp, 0, SEEK_END);
-		size_t size = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-		this->code.resize(size);
-		fread(this->code.data(), 1, size, fp);
-		fclose(fp);
+		this->code.assign(data, data + size);
 	}
 
 	void Image::CreateRGBA(const Image& img_rgb, const Image& img_a)
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Mid
+{
+	// Encoders for the EXT_meshopt_compression bitstreams: ATTRIBUTES (vertex codec, version 0)
+	// and TRIANGLES (index codec, version 1). Both produce the exact layout decoders expect,
+	// including the trailing padding they rely on for bounds checks.
+	namespace Meshopt
+	{
+		const size_t byte_group_size = 16;
+		const size_t vertex_block_max_size = 256;
+		const size_t vertex_block_size_bytes = 8192;
+		const size_t tail_max_size = 32;
+
+		inline size_t VertexBlockSize(size_t vertex_size)
+		{
+			size_t result = vertex_block_size_bytes / vertex_size;
+			result &= ~(byte_group_size - 1);
+			return result < vertex_block_max_size ? result : vertex_block_max_size;
+		}
+
+		inline size_t EncodeVertexBufferBound(size_t vertex_count, size_t vertex_size)
+		{
+			size_t block_size = VertexBlockSize(vertex_size);
+			size_t block_count = (vertex_count + block_size - 1) / block_size;
+			size_t block_header_size = (block_size / byte_group_size + 3) / 4;
+			size_t tail_size = vertex_size < tail_max_size ? tail_max_size : vertex_size;
+			return 1 + block_count * vertex_size * (block_header_size + block_size) + tail_size;
+		}
+
+		// Bytes a group of 16 deltas takes with bits per value; 1 stands for the all-zero group.
+		inline size_t BytesGroupMeasure(const uint8_t* group, int bits)
+		{
+			if (bits == 1)
+			{
+				for (size_t i = 0; i < byte_group_size; i++)
+				{
+					if (group[i] != 0) return (size_t)-1;
+				}
+				return 0;
+			}
+			if (bits == 8) return byte_group_size;
+
+			size_t result = byte_group_size * bits / 8;
+			uint8_t sentinel = (uint8_t)((1 << bits) - 1);
+			for (size_t i = 0; i < byte_group_size; i++)
+			{
+				if (group[i] >= sentinel) result++;
+			}
+			return result;
+		}
+
+		// Packs bits per value, most significant first, then a full byte for every value that
+		// doesn't fit (stored as the all-ones sentinel in the packed part).
+		inline uint8_t* EncodeBytesGroup(uint8_t* data, const uint8_t* group, int bits)
+		{
+			if (bits == 1) return data;
+			if (bits == 8)
+			{
+				memcpy(data, group, byte_group_size);
+				return data + byte_group_size;
+			}
+
+			size_t per_byte = 8 / bits;
+			uint8_t sentinel = (uint8_t)((1 << bits) - 1);
+			for (size_t i = 0; i < byte_group_size; i += per_byte)
+			{
+				uint8_t byte = 0;
+				for (size_t k = 0; k < per_byte; k++)
+				{
+					uint8_t enc = group[i + k] >= sentinel ? sentinel : group[i + k];
+					byte = (uint8_t)((byte << bits) | enc);
+				}
+				*data++ = byte;
+			}
+			for (size_t i = 0; i < byte_group_size; i++)
+			{
+				if (group[i] >= sentinel) *data++ = group[i];
+			}
+			return data;
+		}
+
+		// A header of 2 bits per group selecting 0, 2, 4 or 8 bits, followed by the groups.
+		inline uint8_t* EncodeBytes(uint8_t* data, const uint8_t* buffer, size_t buffer_size)
+		{
+			uint8_t* header = data;
+			size_t header_size = (buffer_size / byte_group_size + 3) / 4;
+			memset(header, 0, header_size);
+			data += header_size;
+
+			for (size_t i = 0; i < buffer_size; i += byte_group_size)
+			{
+				int best_bits = 8;
+				size_t best_size = BytesGroupMeasure(buffer + i, 8);
+				for (int bits = 1; bits < 8; bits *= 2)
+				{
+					size_t size = BytesGroupMeasure(buffer + i, bits);
+					if (size < best_size)
+					{
+						best_bits = bits;
+						best_size = size;
+					}
+				}
+
+				int bitslog2 = best_bits == 1 ? 0 : best_bits == 2 ? 1 : best_bits == 4 ? 2 : 3;
+				size_t group_index = i / byte_group_size;
+				header[group_index / 4] |= (uint8_t)(bitslog2 << ((group_index % 4) * 2));
+				data = EncodeBytesGroup(data, buffer + i, best_bits);
+			}
+			return data;
+		}
+
+		// Each byte lane of the block is delta coded against the previous vertex and zigzagged.
+		inline uint8_t* EncodeVertexBlock(uint8_t* data, const uint8_t* vertex_data, size_t vertex_count, size_t vertex_size, uint8_t last_vertex[256])
+		{
+			uint8_t buffer[vertex_block_max_size];
+			memset(buffer, 0, sizeof(buffer));
+
+			for (size_t k = 0; k < vertex_size; k++)
+			{
+				uint8_t p = last_vertex[k];
+				for (size_t i = 0; i < vertex_count; i++)
+				{
+					uint8_t v = vertex_data[i * vertex_size + k];
+					uint8_t delta = (uint8_t)(v - p);
+					buffer[i] = (uint8_t)(((int8_t)delta >> 7) ^ (delta << 1));
+					p = v;
+				}
+				data = EncodeBytes(data, buffer, (vertex_count + byte_group_size - 1) & ~(byte_group_size - 1));
+			}
+
+			memcpy(last_vertex, vertex_data + vertex_size * (vertex_count - 1), vertex_size);
+			return data;
+		}
+
+		// vertex_size must be a multiple of 4, at most 256.
+		inline void EncodeVertexBuffer(const uint8_t* vertex_data, size_t vertex_count, size_t vertex_size, std::vector<uint8_t>& out)
+		{
+			out.resize(EncodeVertexBufferBound(vertex_count, vertex_size));
+			uint8_t* data = out.data();
+			*data++ = 0xa0;
+
+			uint8_t first_vertex[256] = {};
+			if (vertex_count > 0) memcpy(first_vertex, vertex_data, vertex_size);
+			uint8_t last_vertex[256] = {};
+			memcpy(last_vertex, first_vertex, vertex_size);
+
+			size_t block_size = VertexBlockSize(vertex_size);
+			for (size_t offset = 0; offset < vertex_count; offset += block_size)
+			{
+				size_t count = offset + block_size < vertex_count ? block_size : vertex_count - offset;
+				data = EncodeVertexBlock(data, vertex_data + offset * vertex_size, count, vertex_size, last_vertex);
+			}
+
+			// The first vertex goes last, padded to 32 bytes.
+			if (vertex_size < tail_max_size)
+			{
+				memset(data, 0, tail_max_size - vertex_size);
+				data += tail_max_size - vertex_size;
+			}
+			memcpy(data, first_vertex, vertex_size);
+			data += vertex_size;
+
+			out.resize(data - out.data());
+		}
+
+		inline void EncodeVByte(uint8_t*& data, uint32_t v)
+		{
+			do
+			{
+				*data++ = (uint8_t)((v & 127) | (v > 127 ? 128 : 0));
+				v >>= 7;
+			} while (v);
+		}
+
+		inline void EncodeIndex(uint8_t*& data, uint32_t index, uint32_t last)
+		{
+			uint32_t d = index - last;
+			EncodeVByte(data, (d << 1) ^ (uint32_t)((int32_t)d >> 31));
+		}
+
+		// Index codec state: the last 16 edges and vertices seen, most recent at offset - 1.
+		struct IndexFifos
+		{
+			uint32_t edges[16][2];
+			uint32_t verts[16];
+			size_t edge_offset = 0;
+			size_t vert_offset = 0;
+
+			IndexFifos()
+			{
+				memset(edges, -1, sizeof(edges));
+				memset(verts, -1, sizeof(verts));
+			}
+
+			// Returns (age << 2) | rotation of the first edge of a, b, c found, or -1.
+			int FindEdge(uint32_t a, uint32_t b, uint32_t c) const
+			{
+				for (int i = 0; i < 16; i++)
+				{
+					size_t index = (edge_offset - 1 - i) & 15;
+					uint32_t e0 = edges[index][0];
+					uint32_t e1 = edges[index][1];
+					if (e0 == a && e1 == b) return (i << 2) | 0;
+					if (e0 == b && e1 == c) return (i << 2) | 1;
+					if (e0 == c && e1 == a) return (i << 2) | 2;
+				}
+				return -1;
+			}
+
+			void PushEdge(uint32_t a, uint32_t b)
+			{
+				edges[edge_offset][0] = a;
+				edges[edge_offset][1] = b;
+				edge_offset = (edge_offset + 1) & 15;
+			}
+
+			int FindVertex(uint32_t v) const
+			{
+				for (int i = 0; i < 16; i++)
+				{
+					if (verts[(vert_offset - 1 - i) & 15] == v) return i;
+				}
+				return -1;
+			}
+
+			void PushVertex(uint32_t v)
+			{
+				verts[vert_offset] = v;
+				vert_offset = (vert_offset + 1) & 15;
+			}
+		};
+
+		// Triangle list, index_size 2 or 4 bytes.
+		inline void EncodeIndexBuffer(const void* index_data, size_t index_count, size_t index_size, std::vector<uint8_t>& out)
+		{
+			static const int triangle_order[3][3] = { { 0, 1, 2 }, { 1, 2, 0 }, { 2, 0, 1 } };
+
+			// Fixed table of the most frequent fifo pairs, also written out as the stream's tail.
+			static const uint8_t codeaux_table[16] = { 0x00, 0x76, 0x87, 0x56, 0x67, 0x78, 0xa9, 0x86, 0x65, 0x89, 0x68, 0x98, 0x01, 0x69, 0, 0 };
+
+			std::vector<uint32_t> indices(index_count);
+			for (size_t i = 0; i < index_count; i++)
+			{
+				if (index_size == 2) indices[i] = ((const uint16_t*)index_data)[i];
+				else indices[i] = ((const uint32_t*)index_data)[i];
+			}
+
+			// Worst case per triangle: a code byte, an aux byte and three 5 byte varints.
+			size_t num_tris = index_count / 3;
+			out.resize(1 + num_tris * 17 + 16);
+			out[0] = 0xe1;
+			uint8_t* code = out.data() + 1;
+			uint8_t* data = code + num_tris;
+
+			IndexFifos fifos;
+			uint32_t next = 0;
+			uint32_t last = 0;
+			const int fec_max = 13;
+
+			for (size_t i = 0; i < num_tris * 3; i += 3)
+			{
+				int fer = fifos.FindEdge(indices[i], indices[i + 1], indices[i + 2]);
+				if (fer >= 0 && (fer >> 2) < 15)
+				{
+					// The first edge (after rotation) is in the edge fifo, only c is coded.
+					const int* order = triangle_order[fer & 3];
+					uint32_t a = indices[i + order[0]], b = indices[i + order[1]], c = indices[i + order[2]];
+
+					int fe = fer >> 2;
+					int fc = fifos.FindVertex(c);
+					int fec = (fc >= 1 && fc < fec_max) ? fc : (c == next) ? (next++, 0) : 15;
+					if (fec == 15)
+					{
+						if (c + 1 == last) fec = 13, last = c;
+						if (c == last + 1) fec = 14, last = c;
+					}
+
+					*code++ = (uint8_t)((fe << 4) | fec);
+					if (fec == 15) EncodeIndex(data, c, last), last = c;
+					if (fec == 0 || fec >= fec_max) fifos.PushVertex(c);
+
+					fifos.PushEdge(c, b);
+					fifos.PushEdge(a, c);
+				}
+				else
+				{
+					// Rotate so that a is the next new vertex when possible.
+					uint32_t b0 = indices[i + 1], c0 = indices[i + 2];
+					int rotation = b0 == next ? 1 : c0 == next ? 2 : 0;
+					const int* order = triangle_order[rotation];
+					uint32_t a = indices[i + order[0]], b = indices[i + order[1]], c = indices[i + order[2]];
+
+					bool reset = false;
+					if (a == 0 && b == 1 && c == 2 && next > 0)
+					{
+						reset = true;
+						next = 0;
+						memset(fifos.verts, -1, sizeof(fifos.verts));
+					}
+
+					int fb = fifos.FindVertex(b);
+					int fc = fifos.FindVertex(c);
+
+					int fea = (a == next) ? (next++, 0) : 15;
+					int feb = (fb >= 0 && fb < 14) ? fb + 1 : (b == next) ? (next++, 0) : 15;
+					int fec = (fc >= 0 && fc < 14) ? fc + 1 : (c == next) ? (next++, 0) : 15;
+
+					uint8_t codeaux = (uint8_t)((feb << 4) | fec);
+					int codeaux_index = -1;
+					for (int k = 0; k < 16; k++)
+					{
+						if (codeaux_table[k] == codeaux)
+						{
+							codeaux_index = k;
+							break;
+						}
+					}
+
+					if (fea == 0 && codeaux_index >= 0 && codeaux_index < 14 && !reset)
+					{
+						*code++ = (uint8_t)((15 << 4) | codeaux_index);
+					}
+					else
+					{
+						*code++ = (uint8_t)((15 << 4) | 14 | fea);
+						*data++ = codeaux;
+					}
+
+					if (fea == 15) EncodeIndex(data, a, last), last = a;
+					if (feb == 15) EncodeIndex(data, b, last), last = b;
+					if (fec == 15) EncodeIndex(data, c, last), last = c;
+
+					if (fea == 0 || fea == 15) fifos.PushVertex(a);
+					if (feb == 0 || feb == 15) fifos.PushVertex(b);
+					if (fec == 0 || fec == 15) fifos.PushVertex(c);
+
+					fifos.PushEdge(b, a);
+					fifos.PushEdge(c, b);
+					fifos.PushEdge(a, c);
+				}
+			}
+
+			memcpy(data, codeaux_table, 16);
+			data += 16;
+			out.resize(data - out.data());
+		}
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <tinyusdz.hh>
+
+namespace Mid
+{
+	// Breadth-first, flattened copy of the stage hierarchy, built once per conversion and
+	// walked by every pass instead of re-traversing the prims. Children of materials and
+	// meshes are not visited.
+	struct PrimIndex
+	{
+		struct Entry
+		{
+			tinyusdz::Prim* prim;
+			uint32_t type_id;
+			int parent;			// entry index, -1 for the root
+			int path;			// into paths, unique to this entry
+			int material_path;	// Xform material binding on this prim or the nearest ancestor, -1 if none
+			int skel_path;		// SkelRoot skel:skeleton on this prim or the nearest ancestor, -1 if none
+		};
+
+		std::vector<Entry> entries;
+		std::vector<std::string> paths;
+		std::vector<int> materials;
+		std::vector<int> animations;
+
+		// Binding targets are shared by many prims and interned; prim paths are unique and
+		// appended without hashing them.
+		int Intern(const std::string& path)
+		{
+			auto iter = path_map.find(path);
+			if (iter != path_map.end()) return iter->second;
+			int idx = (int)paths.size();
+			paths.push_back(path);
+			path_map[path] = idx;
+			return idx;
+		}
+
+		const std::string& Path(int idx) const
+		{
+			static const std::string empty;
+			return idx >= 0 ? paths[idx] : empty;
+		}
+
+		void Build(tinyusdz::Prim* root)
+		{
+			paths.push_back("/" + root->element_path().full_path_name());
+			entries.push_back({ root, 0, -1, 0, -1, -1 });
+
+			for (size_t i = 0; i < entries.size(); i++)
+			{
+				Entry entry = entries[i];
+				entry.type_id = entry.prim->data().type_id();
+
+				if (entry.type_id == tinyusdz::value::TYPE_ID_GEOM_XFORM)
+				{
+					auto* node_in = entry.prim->data().as<tinyusdz::Xform>();
+					if (node_in->materialBinding.has_value())
+					{
+						entry.material_path = Intern(node_in->materialBinding.value().targetPath.full_path_name());
+					}
+				}
+				else if (entry.type_id == tinyusdz::value::TYPE_ID_SKEL_ROOT)
+				{
+					auto* node_in = entry.prim->data().as<tinyusdz::SkelRoot>();
+					auto iter = node_in->props.find("skel:skeleton");
+					if (iter != node_in->props.end())
+					{
+						entry.skel_path = Intern(iter->second.get_relationship().targetPath.full_path_name());
+					}
+				}
+				else if (entry.type_id == tinyusdz::value::TYPE_ID_MATERIAL)
+				{
+					materials.push_back((int)i);
+				}
+				else if (entry.type_id == tinyusdz::value::TYPE_ID_SKELANIMATION)
+				{
+					animations.push_back((int)i);
+				}
+				entries[i] = entry;
+
+				if (entry.type_id == tinyusdz::value::TYPE_ID_MATERIAL
+					|| entry.type_id == tinyusdz::value::TYPE_ID_GEOM_MESH) continue;
+
+				size_t num_children = entry.prim->children().size();
+				for (size_t j = 0; j < num_children; j++)
+				{
+					tinyusdz::Prim* child = &entry.prim->children()[j];
+					paths.push_back(paths[entry.path] + "/" + child->element_path().full_path_name());
+					entries.push_back({ child, 0, (int)i, (int)paths.size() - 1, entry.material_path, entry.skel_path });
+				}
+			}
+		}
+
+	private:
+		std::unordered_map<std::string, int> path_map;
+	};
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cmath>
+
+namespace Mid
+{
+	// Normalized integer encodings used by KHR_mesh_quantization. A value is first rounded to
+	// bits bits of precision, then stored in the normalized range of a container_bits integer,
+	// so fewer bits give a coarser grid (and more compressible data) in the same component type.
+
+	// v in [-1, 1], stored as a signed normalized integer.
+	inline int QuantizeSnorm(float v, int bits, int container_bits)
+	{
+		float m = (float)((1 << (bits - 1)) - 1);
+		float m_out = (float)((1 << (container_bits - 1)) - 1);
+		if (v > 1.0f) v = 1.0f;
+		if (v < -1.0f) v = -1.0f;
+		return (int)std::round(std::round(v * m) * m_out / m);
+	}
+
+	// v in [0, 1], stored as an unsigned normalized integer.
+	inline int QuantizeUnorm(float v, int bits, int container_bits)
+	{
+		float m = (float)((1 << bits) - 1);
+		float m_out = (float)((1 << container_bits) - 1);
+		if (v > 1.0f) v = 1.0f;
+		if (v < 0.0f) v = 0.0f;
+		return (int)std::round(std::round(v * m) * m_out / m);
+	}
+
+	// What a viewer reads back from a normalized integer.
+	inline float DecodeSnorm(int q, int container_bits)
+	{
+		float v = (float)q / (float)((1 << (container_bits - 1)) - 1);
+		return v < -1.0f ? -1.0f : v;
+	}
+
+	inline float DecodeUnorm(int q, int container_bits)
+	{
+		return (float)q / (float)((1 << container_bits) - 1);
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace Mid
+{
+	class ThreadPool
+	{
+	public:
+		// num_threads == 0 picks one worker per hardware thread.
+		explicit ThreadPool(unsigned num_threads = 0)
+		{
+			if (num_threads == 0)
+			{
+				num_threads = std::thread::hardware_concurrency();
+				if (num_threads == 0) num_threads = 1;
+			}
+			for (unsigned i = 0; i < num_threads; i++)
+			{
+				workers.emplace_back([this]() { Run(); });
+			}
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			cond.notify_all();
+			for (size_t i = 0; i < workers.size(); i++)
+			{
+				workers[i].join();
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Process-wide pool with one worker per hardware thread, shared by conversions.
+		static ThreadPool& Shared()
+		{
+			static ThreadPool pool;
+			return pool;
+		}
+
+		unsigned Size() const
+		{
+			return (unsigned)workers.size();
+		}
+
+		void Enqueue(std::function<void()> task)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				tasks.push(std::move(task));
+			}
+			cond.notify_one();
+		}
+
+		// Runs func(i) for i in [0, count) on at most max_threads threads (0 = no limit). The
+		// calling thread takes part, so this may be called from inside a pool task without
+		// deadlocking. Returns once every item is done.
+		template<typename Func>
+		void ParallelFor(size_t count, Func func, unsigned max_threads = 0)
+		{
+			if (count == 0) return;
+
+			struct Batch
+			{
+				std::atomic<size_t> next{ 0 };
+				std::atomic<size_t> done{ 0 };
+				size_t count = 0;
+				std::function<void(size_t)> func;
+				std::mutex mutex;
+				std::condition_variable cond;
+
+				void Work()
+				{
+					size_t i;
+					while ((i = next.fetch_add(1)) < count)
+					{
+						func(i);
+						if (done.fetch_add(1) + 1 == count)
+						{
+							std::unique_lock<std::mutex> lock(mutex);
+							cond.notify_all();
+						}
+					}
+				}
+			};
+
+			std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+			batch->count = count;
+			batch->func = func;
+
+			size_t num_helpers = workers.size() < count - 1 ? workers.size() : count - 1;
+			if (max_threads > 0 && num_helpers > max_threads - 1) num_helpers = max_threads - 1;
+			for (size_t i = 0; i < num_helpers; i++)
+			{
+				Enqueue([batch]() { batch->Work(); });
+			}
+
+			batch->Work();
+
+			std::unique_lock<std::mutex> lock(batch->mutex);
+			batch->cond.wait(lock, [&batch]() { return batch->done.load() == batch->count; });
+		}
+
+		// Like ParallelFor, and also calls commit(i) one at a time in increasing order of i as
+		// soon as work(0..i) are done, so results are consumed while later items still run.
+		template<typename Work, typename Commit>
+		void ParallelForOrdered(size_t count, Work work, Commit commit, unsigned max_threads = 0)
+		{
+			std::vector<char> done(count, 0);
+			size_t next = 0;
+			std::mutex mutex_commit;
+			ParallelFor(count, [&](size_t i)
+				{
+					work(i);
+					std::unique_lock<std::mutex> lock(mutex_commit);
+					done[i] = 1;
+					while (next < count && done[next])
+					{
+						commit(next);
+						next++;
+					}
+				}, max_threads);
+		}
+
+	private:
+		void Run()
+		{
+			while (true)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cond.wait(lock, [this]() { return stopping || !tasks.empty(); });
+					if (tasks.empty()) return;
+					task = std::move(tasks.front());
+					tasks.pop();
+				}
+				task();
+			}
+		}
+
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> tasks;
+		std::mutex mutex;
+		std::condition_variable cond;
+		bool stopping = false;
+	};
+}
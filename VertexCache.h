@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Mid
+{
+	struct VertexCacheStats
+	{
+		float acmr = 0.0f;	// transformed vertices per triangle
+		float atvr = 0.0f;	// transformed vertices per referenced vertex, 1.0 is optimal
+	};
+
+	// Simulates a FIFO post-transform cache of cache_size entries over a triangle list.
+	inline VertexCacheStats AnalyzeVertexCache(const int* indices, size_t num_indices, size_t num_verts, unsigned cache_size = 16)
+	{
+		VertexCacheStats stats;
+		size_t num_tris = num_indices / 3;
+		if (num_tris == 0) return stats;
+
+		// Position in the stream of misses at which each vertex entered the cache, 0 if never.
+		std::vector<size_t> stamps(num_verts, 0);
+		size_t transformed = 0;
+		size_t referenced = 0;
+		for (size_t i = 0; i < num_tris * 3; i++)
+		{
+			size_t& stamp = stamps[indices[i]];
+			if (stamp != 0 && stamp + cache_size > transformed) continue;
+			if (stamp == 0) referenced++;
+			stamp = ++transformed;
+		}
+
+		stats.acmr = (float)transformed / (float)num_tris;
+		stats.atvr = (float)transformed / (float)referenced;
+		return stats;
+	}
+
+	// Reorders the triangles of an indexed triangle list in place for post-transform cache
+	// locality (Tipsify, Sander et al. 2007): fans around the current vertex are emitted and
+	// the next fanning vertex is picked among the ones just used that will still be in the
+	// cache, falling back to recently used vertices and then to the input order. Triangles
+	// keep their winding and corner order.
+	inline void OptimizeVertexCache(int* indices, size_t num_indices, size_t num_verts, unsigned cache_size = 16)
+	{
+		size_t num_tris = num_indices / 3;
+		if (num_tris == 0 || num_verts == 0) return;
+
+		// Triangles around each vertex.
+		std::vector<int> live(num_verts, 0);
+		for (size_t i = 0; i < num_tris * 3; i++)
+		{
+			live[indices[i]]++;
+		}
+		std::vector<size_t> adj_offsets(num_verts + 1, 0);
+		for (size_t v = 0; v < num_verts; v++)
+		{
+			adj_offsets[v + 1] = adj_offsets[v] + live[v];
+		}
+		std::vector<int> adj(num_tris * 3);
+		std::vector<size_t> adj_fill(adj_offsets.begin(), adj_offsets.end() - 1);
+		for (size_t i = 0; i < num_tris * 3; i++)
+		{
+			adj[adj_fill[indices[i]]++] = (int)(i / 3);
+		}
+
+		std::vector<int> out;
+		out.reserve(num_tris * 3);
+		std::vector<char> emitted(num_tris, 0);
+		std::vector<int> cache_time(num_verts, 0);
+		std::vector<int> dead_end;
+		std::vector<int> candidates;
+		int time = (int)cache_size + 1;
+		size_t cursor = 0;
+
+		int fanning = indices[0];
+		while (fanning >= 0)
+		{
+			candidates.clear();
+			for (size_t j = adj_offsets[fanning]; j < adj_offsets[fanning + 1]; j++)
+			{
+				int t = adj[j];
+				if (emitted[t]) continue;
+				emitted[t] = 1;
+				for (int k = 0; k < 3; k++)
+				{
+					int v = indices[t * 3 + k];
+					out.push_back(v);
+					dead_end.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+					if (time - cache_time[v] > (int)cache_size)
+					{
+						cache_time[v] = time;
+						time++;
+					}
+				}
+			}
+
+			// Prefer the candidate that is still cached and has the oldest entry, so the most
+			// triangles are emitted before it is evicted.
+			int next = -1;
+			int best_priority = -1;
+			for (size_t j = 0; j < candidates.size(); j++)
+			{
+				int v = candidates[j];
+				if (live[v] <= 0) continue;
+				int priority = 0;
+				if (time - cache_time[v] + 2 * live[v] <= (int)cache_size) priority = time - cache_time[v];
+				if (priority > best_priority)
+				{
+					best_priority = priority;
+					next = v;
+				}
+			}
+
+			while (next < 0 && !dead_end.empty())
+			{
+				int v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0) next = v;
+			}
+			while (next < 0 && cursor < num_verts)
+			{
+				if (live[cursor] > 0) next = (int)cursor;
+				cursor++;
+			}
+			fanning = next;
+		}
+
+		for (size_t i = 0; i < out.size(); i++)
+		{
+			indices[i] = out[i];
+		}
+	}
+
+	// Renumbers vertices in the order the index buffer first uses them, so vertex fetches walk
+	// memory forward, and drops vertices no triangle references. Rewrites indices in place and
+	// fills remap with the new id of each old vertex (-1 if dropped). Returns the number of
+	// vertices left.
+	inline size_t OptimizeVertexFetch(int* indices, size_t num_indices, size_t num_verts, std::vector<int>& remap)
+	{
+		remap.assign(num_verts, -1);
+		int next = 0;
+		for (size_t i = 0; i < num_indices; i++)
+		{
+			int& id = remap[indices[i]];
+			if (id < 0) id = next++;
+			indices[i] = id;
+		}
+		return (size_t)next;
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Mid
+{
+	// Deduplicates fixed-size vertex keys, comparing every byte so distinct keys are never
+	// merged. Open addressing with linear probing in a power-of-two table sized up front for
+	// max_keys, so it never rehashes. Ids are assigned in first-seen order.
+	class VertexWelder
+	{
+	public:
+		// key_size must be a multiple of 4.
+		VertexWelder(size_t key_size, size_t max_keys)
+			: key_size(key_size)
+		{
+			size_t num_slots = 16;
+			while (num_slots < max_keys + max_keys / 2) num_slots *= 2;
+			slots.resize(num_slots, { -1, 0 });
+			mask = num_slots - 1;
+			keys.reserve(key_size * max_keys);
+		}
+
+		// Returns the id of key, adding it if it hasn't been seen.
+		int Insert(const void* key)
+		{
+			uint32_t hash = Hash(key);
+			size_t i = hash & mask;
+			while (true)
+			{
+				Slot& slot = slots[i];
+				if (slot.id < 0)
+				{
+					slot.id = (int)num_keys;
+					slot.hash = hash;
+					const uint8_t* p = (const uint8_t*)key;
+					keys.insert(keys.end(), p, p + key_size);
+					return (int)num_keys++;
+				}
+				if (slot.hash == hash && memcmp(keys.data() + (size_t)slot.id * key_size, key, key_size) == 0)
+				{
+					return slot.id;
+				}
+				i = (i + 1) & mask;
+			}
+		}
+
+		size_t Size() const
+		{
+			return num_keys;
+		}
+
+		const uint8_t* Key(int id) const
+		{
+			return keys.data() + (size_t)id * key_size;
+		}
+
+	private:
+		struct Slot
+		{
+			int id;
+			uint32_t hash;
+		};
+
+		uint32_t Hash(const void* key) const
+		{
+			const uint8_t* p = (const uint8_t*)key;
+			uint64_t h = 0x9E3779B97F4A7C15ull ^ key_size;
+			for (size_t i = 0; i < key_size; i += 4)
+			{
+				uint32_t w;
+				memcpy(&w, p + i, 4);
+				h = (h ^ w) * 0xff51afd7ed558ccdull;
+				h ^= h >> 32;
+			}
+			return (uint32_t)h;
+		}
+
+		size_t key_size;
+		size_t mask;
+		size_t num_keys = 0;
+		std::vector<Slot> slots;
+		std::vector<uint8_t> keys;
+	};
+}
@@ -0,0 +1,104 @@
+// Compares reading a SkelAnimation's translations the way usd2glb used to, fetching (and so
+// copying) every time sample again for each joint, with Mid::TransposeJointSamples, which
+// walks the samples once. The clip is synthetic mocap: one sample per frame, every joint
+// animated.
+//
+//   anim_bench [joints] [frames]
+
+#include <cstdio>
+#include <cstdlib>
+#include <array>
+#include <chrono>
+#include <vector>
+#include "Animation.h"
+
+struct Vec3
+{
+	float x, y, z;
+};
+
+struct Sample
+{
+	double t;
+	std::vector<std::array<float, 3>> value;
+};
+
+struct Clip
+{
+	std::vector<Sample> samples;
+
+	// Like get_timesamples().get_samples(): a copy of every sample.
+	std::vector<Sample> get_samples() const
+	{
+		return samples;
+	}
+};
+
+static double ms_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char* argv[])
+{
+	size_t num_joints = argc > 1 ? atoi(argv[1]) : 200;
+	size_t num_frames = argc > 2 ? atoi(argv[2]) : 10000;
+	double time_codes_per_sec = 30.0;
+
+	Clip clip;
+	clip.samples.resize(num_frames);
+	for (size_t j = 0; j < num_frames; j++)
+	{
+		clip.samples[j].t = (double)j;
+		clip.samples[j].value.resize(num_joints);
+		for (size_t i = 0; i < num_joints; i++)
+		{
+			clip.samples[j].value[i] = { (float)i, (float)j * 0.01f, (float)(i ^ j) };
+		}
+	}
+	printf("%zu joints, %zu frames\n", num_joints, num_frames);
+
+	auto convert = [](const std::array<float, 3>& v)
+	{
+		return Vec3{ v[0], v[1], v[2] };
+	};
+
+	double checksum_fetch = 0.0;
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < num_joints; i++)
+		{
+			auto translations = clip.get_samples();
+			std::vector<float> times(translations.size());
+			std::vector<Vec3> values(translations.size());
+			for (size_t j = 0; j < translations.size(); j++)
+			{
+				times[j] = (float)(translations[j].t / time_codes_per_sec);
+				values[j] = convert(translations[j].value[i]);
+			}
+			checksum_fetch += times.back() + values.back().x + values.back().y + values.back().z;
+		}
+		printf("fetch per joint        %9.1fms\n", ms_since(t0));
+	}
+
+	double checksum_columns = 0.0;
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		auto samples = clip.get_samples();
+		Mid::JointTracks<Vec3> tracks;
+		Mid::TransposeJointSamples(samples, num_joints, time_codes_per_sec, Vec3{ 0.0f, 0.0f, 0.0f }, convert, tracks);
+		for (size_t i = 0; i < num_joints; i++)
+		{
+			const Vec3& last = tracks.Track(i)[num_frames - 1];
+			checksum_columns += tracks.times.back() + last.x + last.y + last.z;
+		}
+		printf("TransposeJointSamples  %9.1fms\n", ms_since(t0));
+	}
+
+	if (checksum_fetch != checksum_columns)
+	{
+		printf("results differ\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+// Checks every crc64 variant against Check("123456789") and the byte-at-a-time table on
+// random lengths, alignments and seeds, then measures throughput.
+//
+//   crc64_bench [megabytes]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <crc64.h>
+
+typedef uint64_t (*crc64_fn)(uint64_t crc, const unsigned char* s, uint64_t l);
+
+struct Variant
+{
+	const char* name;
+	crc64_fn fn;
+};
+
+int main(int argc, char* argv[])
+{
+	size_t size = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+
+	Variant variants[] = {
+		{ "bytewise", crc64_bytewise },
+		{ "slice8", crc64_slice8 },
+		{ "slice16", crc64_slice16 },
+		{ "pclmul", crc64_pclmul },
+		{ "crc64 (dispatch)", crc64 },
+	};
+	printf("pclmul %s\n", crc64_pclmul_supported() ? "supported" : "not supported, falls back to slice16");
+
+	const uint64_t check = UINT64_C(0xe9c6d914c4b8d9ca);
+	const char* check_str = "123456789";
+	int failed = 0;
+	for (const Variant& v : variants)
+	{
+		uint64_t crc = v.fn(0, (const unsigned char*)check_str, strlen(check_str));
+		if (crc != check)
+		{
+			printf("%s: Check(\"123456789\") = %016llx, expected %016llx\n", v.name, (unsigned long long)crc, (unsigned long long)check);
+			failed = 1;
+		}
+	}
+
+	std::mt19937_64 rng(1);
+	std::vector<unsigned char> data(size + 64);
+	for (size_t i = 0; i < data.size(); i++) data[i] = (unsigned char)rng();
+
+	for (int iter = 0; iter < 2000; iter++)
+	{
+		size_t len = iter < 600 ? iter : rng() % 100000;
+		size_t align = rng() % 64;
+		uint64_t seed = iter % 3 == 0 ? 0 : rng();
+		uint64_t ref = crc64_bytewise(seed, data.data() + align, len);
+		for (const Variant& v : variants)
+		{
+			if (v.fn(seed, data.data() + align, len) != ref)
+			{
+				printf("%s: mismatch at length %zu, offset %zu\n", v.name, len, align);
+				failed = 1;
+			}
+		}
+	}
+	if (failed) return 1;
+	printf("all variants match\n");
+
+	for (const Variant& v : variants)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		uint64_t crc = v.fn(0, data.data(), size);
+		double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		printf("%-18s %8.2f GB/s  %016llx\n", v.name, size / s / 1e9, (unsigned long long)crc);
+	}
+	return 0;
+}
@@ -0,0 +1,432 @@
+// Round-trips the EXT_meshopt_compression encoders in Meshopt.h through decoders written
+// from the extension's bitstream description: vertex buffers of every stride class with
+// random, smooth and constant data, and triangle lists with locality, random indices,
+// degenerate triangles and index resets, in 16 and 32 bits. Decoded vertices must match
+// byte for byte, decoded triangles up to rotation (the index codec may rotate them). Then
+// prints encode and decode throughput and the compression ratio on a grid mesh.
+//
+//   meshopt_bench [quads_per_side]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "Meshopt.h"
+
+// ATTRIBUTES, version 0. Fails on any truncated or trailing data.
+static bool decode_vertex_buffer(uint8_t* dst, size_t vertex_count, size_t vertex_size, const uint8_t* buffer, size_t buffer_size)
+{
+	const size_t tail_size = vertex_size < 32 ? 32 : vertex_size;
+	if (buffer_size < 1 + tail_size || buffer[0] != 0xa0) return false;
+	const uint8_t* data = buffer + 1;
+	const uint8_t* data_end = buffer + buffer_size - tail_size;
+
+	uint8_t last_vertex[256];
+	memcpy(last_vertex, buffer + buffer_size - vertex_size, vertex_size);
+
+	size_t block_size = Mid::Meshopt::VertexBlockSize(vertex_size);
+	uint8_t deltas[256];
+	for (size_t offset = 0; offset < vertex_count; offset += block_size)
+	{
+		size_t count = offset + block_size < vertex_count ? block_size : vertex_count - offset;
+		size_t num_groups = (count + 15) / 16;
+		for (size_t k = 0; k < vertex_size; k++)
+		{
+			const uint8_t* header = data;
+			data += (num_groups + 3) / 4;
+			if (data > data_end) return false;
+			for (size_t g = 0; g < num_groups; g++)
+			{
+				int mode = (header[g / 4] >> ((g % 4) * 2)) & 3;
+				uint8_t* group = deltas + g * 16;
+				if (mode == 0)
+				{
+					memset(group, 0, 16);
+				}
+				else if (mode == 3)
+				{
+					if (data + 16 > data_end) return false;
+					memcpy(group, data, 16);
+					data += 16;
+				}
+				else
+				{
+					int bits = mode == 1 ? 2 : 4;
+					int sentinel = (1 << bits) - 1;
+					const uint8_t* packed = data;
+					data += 16 * bits / 8;
+					if (data > data_end) return false;
+					for (size_t i = 0; i < 16; i++)
+					{
+						size_t bit = i * bits;
+						int enc = (packed[bit / 8] >> (8 - bits - bit % 8)) & sentinel;
+						if (enc == sentinel)
+						{
+							if (data >= data_end) return false;
+							enc = *data++;
+						}
+						group[i] = (uint8_t)enc;
+					}
+				}
+			}
+
+			uint8_t p = last_vertex[k];
+			for (size_t i = 0; i < count; i++)
+			{
+				uint8_t d = deltas[i];
+				p = (uint8_t)(p + ((d >> 1) ^ (uint8_t)-(d & 1)));
+				dst[(offset + i) * vertex_size + k] = p;
+			}
+		}
+		memcpy(last_vertex, dst + (offset + count - 1) * vertex_size, vertex_size);
+	}
+	return data == data_end;
+}
+
+static bool decode_vbyte(const uint8_t*& data, const uint8_t* data_end, uint32_t* v)
+{
+	uint32_t result = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (data >= data_end) return false;
+		uint8_t byte = *data++;
+		result |= (uint32_t)(byte & 127) << shift;
+		if (byte < 128)
+		{
+			*v = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool decode_index(const uint8_t*& data, const uint8_t* data_end, uint32_t* last)
+{
+	uint32_t v;
+	if (!decode_vbyte(data, data_end, &v)) return false;
+	*last += (v >> 1) ^ (0u - (v & 1));
+	return true;
+}
+
+// TRIANGLES, version 1.
+static bool decode_index_buffer(uint32_t* dst, size_t index_count, const uint8_t* buffer, size_t buffer_size)
+{
+	size_t num_tris = index_count / 3;
+	if (index_count % 3 != 0 || buffer_size < 1 + num_tris + 16 || buffer[0] != 0xe1) return false;
+	const uint8_t* code = buffer + 1;
+	const uint8_t* data = code + num_tris;
+	const uint8_t* data_end = buffer + buffer_size - 16;
+	const uint8_t* codeaux_table = data_end;
+
+	uint32_t edges[16][2] = {};
+	uint32_t verts[16] = {};
+	size_t edge_offset = 0;
+	size_t vert_offset = 0;
+	uint32_t next = 0;
+	uint32_t last = 0;
+
+	auto push_edge = [&](uint32_t a, uint32_t b)
+	{
+		edges[edge_offset][0] = a;
+		edges[edge_offset][1] = b;
+		edge_offset = (edge_offset + 1) & 15;
+	};
+	auto push_vertex = [&](uint32_t v)
+	{
+		verts[vert_offset] = v;
+		vert_offset = (vert_offset + 1) & 15;
+	};
+
+	for (size_t t = 0; t < num_tris; t++)
+	{
+		uint8_t codetri = code[t];
+		uint32_t a, b, c;
+		if (codetri < 0xf0)
+		{
+			int fe = codetri >> 4;
+			a = edges[(edge_offset - 1 - fe) & 15][0];
+			b = edges[(edge_offset - 1 - fe) & 15][1];
+			int fec = codetri & 15;
+			if (fec == 0)
+			{
+				c = next++;
+				push_vertex(c);
+			}
+			else if (fec < 13)
+			{
+				c = verts[(vert_offset - 1 - fec) & 15];
+			}
+			else
+			{
+				if (fec == 13) last--;
+				else if (fec == 14) last++;
+				else if (!decode_index(data, data_end, &last)) return false;
+				c = last;
+				push_vertex(c);
+			}
+			push_edge(c, b);
+			push_edge(a, c);
+		}
+		else
+		{
+			uint8_t codeaux;
+			int fea;
+			if (codetri < 0xfe)
+			{
+				codeaux = codeaux_table[codetri & 15];
+				fea = 0;
+			}
+			else
+			{
+				if (data >= data_end) return false;
+				codeaux = *data++;
+				fea = codetri == 0xfe ? 0 : 15;
+				if (codeaux == 0) next = 0;
+			}
+			int feb = codeaux >> 4;
+			int fec = codeaux & 15;
+
+			a = fea == 0 ? next++ : 0;
+			b = feb == 0 ? next++ : verts[(vert_offset - feb) & 15];
+			c = fec == 0 ? next++ : verts[(vert_offset - fec) & 15];
+			if (fea == 15 && !decode_index(data, data_end, &last)) return false;
+			if (fea == 15) a = last;
+			if (feb == 15 && !decode_index(data, data_end, &last)) return false;
+			if (feb == 15) b = last;
+			if (fec == 15 && !decode_index(data, data_end, &last)) return false;
+			if (fec == 15) c = last;
+
+			push_vertex(a);
+			if (feb == 0 || feb == 15) push_vertex(b);
+			if (fec == 0 || fec == 15) push_vertex(c);
+			push_edge(b, a);
+			push_edge(c, b);
+			push_edge(a, c);
+		}
+		dst[t * 3 + 0] = a;
+		dst[t * 3 + 1] = b;
+		dst[t * 3 + 2] = c;
+	}
+	return data == data_end;
+}
+
+static bool same_triangles(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i += 3)
+	{
+		bool same = false;
+		for (int r = 0; r < 3 && !same; r++)
+		{
+			same = a[i] == b[i + r] && a[i + 1] == b[i + (r + 1) % 3] && a[i + 2] == b[i + (r + 2) % 3];
+		}
+		if (!same) return false;
+	}
+	return true;
+}
+
+static void grid_triangles(uint32_t n, uint32_t base, std::vector<uint32_t>& indices)
+{
+	for (uint32_t y = 0; y < n; y++)
+	{
+		for (uint32_t x = 0; x < n; x++)
+		{
+			uint32_t i0 = base + y * (n + 1) + x;
+			uint32_t i1 = i0 + 1;
+			uint32_t i2 = i0 + n + 1;
+			uint32_t i3 = i2 + 1;
+			indices.insert(indices.end(), { i0, i1, i2, i2, i1, i3 });
+		}
+	}
+}
+
+static int check_vertices(const std::vector<uint8_t>& vertices, size_t vertex_count, size_t vertex_size, const char* kind)
+{
+	std::vector<uint8_t> encoded;
+	Mid::Meshopt::EncodeVertexBuffer(vertices.data(), vertex_count, vertex_size, encoded);
+	if (encoded.size() > Mid::Meshopt::EncodeVertexBufferBound(vertex_count, vertex_size))
+	{
+		printf("vertices %s, %zu x %zu: encoded size above the bound\n", kind, vertex_count, vertex_size);
+		return 1;
+	}
+	std::vector<uint8_t> decoded(vertex_count * vertex_size + 1);
+	if (!decode_vertex_buffer(decoded.data(), vertex_count, vertex_size, encoded.data(), encoded.size())
+		|| memcmp(decoded.data(), vertices.data(), vertex_count * vertex_size) != 0)
+	{
+		printf("vertices %s, %zu x %zu: round trip differs\n", kind, vertex_count, vertex_size);
+		return 1;
+	}
+	return 0;
+}
+
+static int check_indices(const std::vector<uint32_t>& indices, const char* kind)
+{
+	uint32_t max_index = 0;
+	for (uint32_t i : indices) max_index = i > max_index ? i : max_index;
+
+	int failed = 0;
+	for (size_t index_size = 2; index_size <= 4; index_size += 2)
+	{
+		if (index_size == 2 && max_index > 0xffff) continue;
+		std::vector<uint16_t> indices16(indices.begin(), indices.end());
+		const void* index_data = index_size == 2 ? (const void*)indices16.data() : (const void*)indices.data();
+
+		std::vector<uint8_t> encoded;
+		Mid::Meshopt::EncodeIndexBuffer(index_data, indices.size(), index_size, encoded);
+		std::vector<uint32_t> decoded(indices.size());
+		if (!decode_index_buffer(decoded.data(), indices.size(), encoded.data(), encoded.size()) || !same_triangles(indices, decoded))
+		{
+			printf("indices %s, %zu triangles, %zu bit: round trip differs\n", kind, indices.size() / 3, index_size * 8);
+			failed = 1;
+		}
+	}
+	return failed;
+}
+
+static double ms_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t n = argc > 1 ? (uint32_t)atoi(argv[1]) : 1024;
+	std::mt19937 rng(1);
+	int failed = 0;
+
+	const size_t vertex_sizes[] = { 4, 8, 12, 16, 20, 24, 28, 32, 36, 44, 48, 64, 100, 128, 252, 256 };
+	const size_t vertex_counts[] = { 0, 1, 2, 15, 16, 17, 255, 256, 257, 511, 1000, 4099 };
+	size_t num_vertex_checks = 0;
+	for (size_t vertex_size : vertex_sizes)
+	{
+		for (size_t vertex_count : vertex_counts)
+		{
+			std::vector<uint8_t> vertices(vertex_count * vertex_size);
+
+			for (size_t i = 0; i < vertices.size(); i++) vertices[i] = (uint8_t)rng();
+			failed |= check_vertices(vertices, vertex_count, vertex_size, "random");
+
+			// Floats along a curve: small deltas in the low bytes, runs in the high ones.
+			for (size_t i = 0; i < vertex_count; i++)
+			{
+				for (size_t k = 0; k < vertex_size / 4; k++)
+				{
+					float v = (float)(i * (k + 1)) * 0.01f + (float)(rng() % 4) * 1e-4f;
+					memcpy(&vertices[i * vertex_size + k * 4], &v, 4);
+				}
+			}
+			failed |= check_vertices(vertices, vertex_count, vertex_size, "smooth");
+
+			// Mostly constant with rare outliers, so every group width shows up.
+			for (size_t i = 0; i < vertices.size(); i++) vertices[i] = rng() % 61 == 0 ? (uint8_t)rng() : (uint8_t)(rng() % 3 == 0 ? 1 : 0);
+			failed |= check_vertices(vertices, vertex_count, vertex_size, "sparse");
+
+			num_vertex_checks += 3;
+		}
+	}
+
+	size_t num_index_checks = 0;
+	{
+		std::vector<uint32_t> indices;
+		grid_triangles(1, 0, indices);
+		failed |= check_indices(indices, "one quad");
+		num_index_checks++;
+
+		indices.clear();
+		grid_triangles(64, 0, indices);
+		failed |= check_indices(indices, "grid");
+		num_index_checks++;
+
+		// A second grid numbered from 0 again makes the encoder emit a reset.
+		grid_triangles(16, 0, indices);
+		grid_triangles(16, 0, indices);
+		failed |= check_indices(indices, "grids restarting at 0");
+		num_index_checks++;
+
+		// Triangles in random order, with random rotations, lose most of the locality.
+		std::vector<uint32_t> shuffled = indices;
+		for (size_t i = shuffled.size() / 3; i > 1; i--)
+		{
+			size_t j = rng() % i;
+			for (int k = 0; k < 3; k++) std::swap(shuffled[(i - 1) * 3 + k], shuffled[j * 3 + k]);
+		}
+		for (size_t i = 0; i < shuffled.size(); i += 3)
+		{
+			if (rng() % 2) std::swap(shuffled[i], shuffled[i + 1]), std::swap(shuffled[i + 1], shuffled[i + 2]);
+		}
+		failed |= check_indices(shuffled, "shuffled grid");
+		num_index_checks++;
+
+		for (uint32_t range : { 3u, 20u, 1000u, 65536u, 1000000u })
+		{
+			indices.resize(3 * 5000);
+			for (size_t i = 0; i < indices.size(); i++) indices[i] = rng() % range;
+			failed |= check_indices(indices, "random");
+			num_index_checks++;
+		}
+
+		indices.clear();
+		for (uint32_t i = 0; i < 3000; i++)
+		{
+			uint32_t v = rng() % 50;
+			indices.insert(indices.end(), { v, v, (uint32_t)(rng() % 50) });
+		}
+		failed |= check_indices(indices, "degenerate");
+		num_index_checks++;
+	}
+	printf("%zu vertex and %zu index streams round-tripped\n", num_vertex_checks, num_index_checks);
+
+	// Throughput on a grid mesh with float positions, normals and uvs.
+	{
+		size_t vertex_size = 32;
+		size_t vertex_count = (size_t)(n + 1) * (n + 1);
+		std::vector<uint8_t> vertices(vertex_count * vertex_size);
+		for (size_t i = 0; i < vertex_count; i++)
+		{
+			float x = (float)(i % (n + 1)) / n;
+			float y = (float)(i / (n + 1)) / n;
+			float v[8] = { x, y, 0.1f * x * y, 0.0f, 0.0f, 1.0f, x, y };
+			memcpy(&vertices[i * vertex_size], v, sizeof(v));
+		}
+		std::vector<uint32_t> indices;
+		grid_triangles(n, 0, indices);
+
+		std::vector<uint8_t> encoded_vertices;
+		auto t0 = std::chrono::steady_clock::now();
+		Mid::Meshopt::EncodeVertexBuffer(vertices.data(), vertex_count, vertex_size, encoded_vertices);
+		double ms_encode = ms_since(t0);
+		std::vector<uint8_t> decoded_vertices(vertices.size());
+		t0 = std::chrono::steady_clock::now();
+		bool ok = decode_vertex_buffer(decoded_vertices.data(), vertex_count, vertex_size, encoded_vertices.data(), encoded_vertices.size());
+		double ms_decode = ms_since(t0);
+		if (!ok || decoded_vertices != vertices)
+		{
+			printf("grid vertices: round trip differs\n");
+			failed = 1;
+		}
+		printf("vertices %zu -> %zu bytes (%.1f%%), encode %.0f MB/s, decode %.0f MB/s\n", vertices.size(), encoded_vertices.size(), 100.0 * encoded_vertices.size() / vertices.size(),
+			vertices.size() / 1e3 / ms_encode, vertices.size() / 1e3 / ms_decode);
+
+		std::vector<uint8_t> encoded_indices;
+		t0 = std::chrono::steady_clock::now();
+		Mid::Meshopt::EncodeIndexBuffer(indices.data(), indices.size(), 4, encoded_indices);
+		ms_encode = ms_since(t0);
+		std::vector<uint32_t> decoded_indices(indices.size());
+		t0 = std::chrono::steady_clock::now();
+		ok = decode_index_buffer(decoded_indices.data(), indices.size(), encoded_indices.data(), encoded_indices.size());
+		ms_decode = ms_since(t0);
+		if (!ok || !same_triangles(indices, decoded_indices))
+		{
+			printf("grid indices: round trip differs\n");
+			failed = 1;
+		}
+		size_t index_bytes = indices.size() * 4;
+		printf("indices  %zu -> %zu bytes (%.1f%%), encode %.0f MB/s, decode %.0f MB/s\n", index_bytes, encoded_indices.size(), 100.0 * encoded_indices.size() / index_bytes,
+			index_bytes / 1e3 / ms_encode, index_bytes / 1e3 / ms_decode);
+	}
+
+	if (failed) printf("round trip FAILED\n");
+	return failed;
+}
@@ -0,0 +1,282 @@
+// Compares the stage traversal usd2glb used to do, three breadth-first std::queue sweeps
+// that rebuild every prim path string and copy the inherited paths along, with the single
+// pass of Mid::PrimIndex followed by walks over its entries. PrimIndex.h needs tinyusdz, so
+// both traversals are reproduced here over a synthetic hierarchy with the same shape of
+// data: an Xform tree of the given depth and fan-out whose leaves are meshes, with material
+// bindings and SkelRoots on some Xforms and materials and SkelAnimations under the root.
+//
+//   prim_index_bench [depth] [fanout]
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum PrimType
+{
+	TYPE_XFORM,
+	TYPE_SKEL_ROOT,
+	TYPE_MESH,
+	TYPE_MATERIAL,
+	TYPE_SKEL_ANIMATION
+};
+
+struct Prim
+{
+	std::string name;
+	PrimType type = TYPE_XFORM;
+	std::string binding;		// material binding of an Xform, skel:skeleton of a SkelRoot
+	std::vector<Prim> children;
+
+	// Like element_path().full_path_name(): a new string on every call.
+	std::string full_path_name() const
+	{
+		return name;
+	}
+};
+
+static void build_tree(Prim& prim, int depth, int fanout, int num_materials, int& counter)
+{
+	for (int i = 0; i < fanout; i++)
+	{
+		Prim child;
+		child.name = (depth > 1 ? "Xform_" : "Mesh_") + std::to_string(counter++);
+		if (depth > 1)
+		{
+			if (counter % 7 == 0)
+			{
+				child.binding = "/Root/Looks/Material_" + std::to_string(counter % num_materials);
+			}
+			else if (counter % 11 == 0)
+			{
+				child.type = TYPE_SKEL_ROOT;
+				child.binding = "/Skel_" + std::to_string(counter);
+			}
+			build_tree(child, depth - 1, fanout, num_materials, counter);
+		}
+		else
+		{
+			child.type = TYPE_MESH;
+		}
+		prim.children.push_back(child);
+	}
+}
+
+static double ms_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// The old traversal: one queue sweep per pass, each building the full path of every prim.
+static size_t traverse_queues(Prim* root)
+{
+	struct Item
+	{
+		Prim* prim;
+		std::string base_path;
+		int idx_material;
+		std::string skel_path;
+	};
+
+	size_t checksum = 0;
+	std::unordered_map<std::string, int> material_map;
+	std::queue<Item> queue_prim;
+
+	queue_prim.push({ root, "", -1, "" });
+	while (!queue_prim.empty())
+	{
+		Item item = queue_prim.front();
+		queue_prim.pop();
+		std::string path = item.base_path + "/" + item.prim->full_path_name();
+		if (item.prim->type == TYPE_MATERIAL)
+		{
+			int idx = (int)material_map.size();
+			material_map[path] = idx;
+		}
+		if (item.prim->type != TYPE_MATERIAL && item.prim->type != TYPE_MESH)
+		{
+			for (size_t i = 0; i < item.prim->children.size(); i++)
+			{
+				queue_prim.push({ &item.prim->children[i], path, -1, "" });
+			}
+		}
+	}
+
+	queue_prim.push({ root, "", -1, "" });
+	while (!queue_prim.empty())
+	{
+		Item item = queue_prim.front();
+		queue_prim.pop();
+		std::string path = item.base_path + "/" + item.prim->full_path_name();
+		if (item.prim->type == TYPE_XFORM && !item.prim->binding.empty())
+		{
+			item.idx_material = material_map[item.prim->binding];
+		}
+		else if (item.prim->type == TYPE_SKEL_ROOT)
+		{
+			item.skel_path = item.prim->binding;
+		}
+		else if (item.prim->type == TYPE_MESH)
+		{
+			checksum += path.size() + item.idx_material + item.skel_path.size();
+		}
+		if (item.prim->type != TYPE_MATERIAL && item.prim->type != TYPE_MESH)
+		{
+			for (size_t i = 0; i < item.prim->children.size(); i++)
+			{
+				queue_prim.push({ &item.prim->children[i], path, item.idx_material, item.skel_path });
+			}
+		}
+	}
+
+	queue_prim.push({ root, "", -1, "" });
+	while (!queue_prim.empty())
+	{
+		Item item = queue_prim.front();
+		queue_prim.pop();
+		std::string path = item.base_path + "/" + item.prim->full_path_name();
+		if (item.prim->type == TYPE_SKEL_ANIMATION)
+		{
+			checksum += path.size();
+		}
+		if (item.prim->type != TYPE_MATERIAL && item.prim->type != TYPE_MESH)
+		{
+			for (size_t i = 0; i < item.prim->children.size(); i++)
+			{
+				queue_prim.push({ &item.prim->children[i], path, -1, "" });
+			}
+		}
+	}
+	return checksum;
+}
+
+// A copy of Mid::PrimIndex::Build and the passes that walk its entries; keep it in step
+// with PrimIndex.h.
+static size_t traverse_index(Prim* root)
+{
+	struct Entry
+	{
+		Prim* prim;
+		int parent;
+		int path;
+		int material_path;
+		int skel_path;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<std::string> paths;
+	std::vector<int> materials;
+	std::vector<int> animations;
+	std::unordered_map<std::string, int> path_map;
+
+	auto intern = [&](const std::string& path)
+	{
+		auto iter = path_map.find(path);
+		if (iter != path_map.end()) return iter->second;
+		int idx = (int)paths.size();
+		paths.push_back(path);
+		path_map[path] = idx;
+		return idx;
+	};
+
+	paths.push_back("/" + root->full_path_name());
+	entries.push_back({ root, -1, 0, -1, -1 });
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		Entry entry = entries[i];
+		if (entry.prim->type == TYPE_XFORM && !entry.prim->binding.empty())
+		{
+			entry.material_path = intern(entry.prim->binding);
+		}
+		else if (entry.prim->type == TYPE_SKEL_ROOT)
+		{
+			entry.skel_path = intern(entry.prim->binding);
+		}
+		else if (entry.prim->type == TYPE_MATERIAL)
+		{
+			materials.push_back((int)i);
+		}
+		else if (entry.prim->type == TYPE_SKEL_ANIMATION)
+		{
+			animations.push_back((int)i);
+		}
+		entries[i] = entry;
+
+		if (entry.prim->type == TYPE_MATERIAL || entry.prim->type == TYPE_MESH) continue;
+
+		for (size_t j = 0; j < entry.prim->children.size(); j++)
+		{
+			Prim* child = &entry.prim->children[j];
+			paths.push_back(paths[entry.path] + "/" + child->full_path_name());
+			entries.push_back({ child, (int)i, (int)paths.size() - 1, entry.material_path, entry.skel_path });
+		}
+	}
+
+	size_t checksum = 0;
+	std::unordered_map<std::string, int> material_map;
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		material_map[paths[entries[materials[i]].path]] = (int)i;
+	}
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const Entry& entry = entries[i];
+		int idx_material = entry.material_path >= 0 ? material_map[paths[entry.material_path]] : -1;
+		if (entry.prim->type != TYPE_MESH) continue;
+		size_t skel_size = entry.skel_path >= 0 ? paths[entry.skel_path].size() : 0;
+		checksum += paths[entry.path].size() + idx_material + skel_size;
+	}
+	for (size_t i = 0; i < animations.size(); i++)
+	{
+		checksum += paths[entries[animations[i]].path].size();
+	}
+	return checksum;
+}
+
+int main(int argc, char* argv[])
+{
+	int depth = argc > 1 ? atoi(argv[1]) : 6;
+	int fanout = argc > 2 ? atoi(argv[2]) : 8;
+	int num_materials = 64;
+
+	Prim root;
+	root.name = "Root";
+	Prim looks;
+	looks.name = "Looks";
+	for (int i = 0; i < num_materials; i++)
+	{
+		Prim material;
+		material.name = "Material_" + std::to_string(i);
+		material.type = TYPE_MATERIAL;
+		looks.children.push_back(material);
+	}
+	root.children.push_back(looks);
+	for (int i = 0; i < 16; i++)
+	{
+		Prim anim;
+		anim.name = "Anim_" + std::to_string(i);
+		anim.type = TYPE_SKEL_ANIMATION;
+		root.children.push_back(anim);
+	}
+	int counter = 0;
+	build_tree(root, depth, fanout, num_materials, counter);
+	printf("depth %d, fanout %d, %d prims\n", depth, fanout, counter + num_materials + 18);
+
+	auto t0 = std::chrono::steady_clock::now();
+	size_t checksum_queues = traverse_queues(&root);
+	printf("three queue sweeps  %9.1fms\n", ms_since(t0));
+
+	t0 = std::chrono::steady_clock::now();
+	size_t checksum_index = traverse_index(&root);
+	printf("PrimIndex           %9.1fms\n", ms_since(t0));
+
+	if (checksum_queues != checksum_index)
+	{
+		printf("results differ\n");
+		return 1;
+	}
+	return 0;
+}
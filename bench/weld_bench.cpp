@@ -0,0 +1,95 @@
+// Compares the crc64 keyed welding that usd2glb used for face-varying meshes with
+// Mid::VertexWelder on a synthetic grid mesh with a uv seam on every quad edge.
+//
+//   weld_bench [quads_per_side]
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <crc64.h>
+#include "Weld.h"
+
+struct PointIn
+{
+	int ind_pnt;
+	float uv[2];
+};
+
+static double ms_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char* argv[])
+{
+	int n = argc > 1 ? atoi(argv[1]) : 2048;
+
+	// n x n quads over (n + 1)^2 points. Every other column of quads gets its own uv island,
+	// so half the face-vertices weld and the other half split along the seams.
+	std::vector<PointIn> corners;
+	corners.reserve((size_t)n * n * 4);
+	for (int y = 0; y < n; y++)
+	{
+		for (int x = 0; x < n; x++)
+		{
+			int ids[4] = { y * (n + 1) + x, y * (n + 1) + x + 1, (y + 1) * (n + 1) + x + 1, (y + 1) * (n + 1) + x };
+			int dx[4] = { 0, 1, 1, 0 };
+			int dy[4] = { 0, 0, 1, 1 };
+			float island = (x & 1) ? 0.5f : 0.0f;
+			for (int k = 0; k < 4; k++)
+			{
+				PointIn pnt;
+				pnt.ind_pnt = ids[k];
+				pnt.uv[0] = island + (float)(x + dx[k]) / n;
+				pnt.uv[1] = (float)(y + dy[k]) / n;
+				corners.push_back(pnt);
+			}
+		}
+	}
+	printf("%zu face-vertices\n", corners.size());
+
+	std::vector<int> indices_crc(corners.size());
+	size_t unique_crc = 0;
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		std::unordered_map<uint64_t, int> points_map;
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			uint64_t hash = crc64(0, (unsigned char*)&corners[i], sizeof(PointIn));
+			auto iter = points_map.find(hash);
+			if (iter != points_map.end())
+			{
+				indices_crc[i] = iter->second;
+			}
+			else
+			{
+				int idx = (int)unique_crc++;
+				points_map[hash] = idx;
+				indices_crc[i] = idx;
+			}
+		}
+		printf("crc64 + unordered_map  %9.1fms  %zu vertices\n", ms_since(t0), unique_crc);
+	}
+
+	std::vector<int> indices_weld(corners.size());
+	size_t unique_weld = 0;
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		Mid::VertexWelder welder(sizeof(PointIn), corners.size());
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			indices_weld[i] = welder.Insert(&corners[i]);
+		}
+		unique_weld = welder.Size();
+		printf("VertexWelder           %9.1fms  %zu vertices\n", ms_since(t0), unique_weld);
+	}
+
+	if (unique_crc != unique_weld || indices_crc != indices_weld)
+	{
+		printf("results differ\n");
+		return 1;
+	}
+	return 0;
+}
@@ -170,7 +170,7 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+uint64_t crc64_bytewise(uint64_t crc, const unsigned char *s, uint64_t l) {
     uint64_t j;
 
     for (j = 0; j < l; j++) {
@@ -179,3 +179,212 @@ uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
     }
     return crc;
 }
+
+/* Slicing-by-8/16: crc64_slice_tab[k][n] is the crc of byte n followed by k zero bytes,
+ * so 8 or 16 input bytes are folded per iteration with independent table lookups. */
+static uint64_t crc64_slice_tab[16][256];
+
+static void crc64_slice_init(void) {
+    int n, k;
+    for (n = 0; n < 256; n++) {
+        crc64_slice_tab[0][n] = crc64_tab[n];
+    }
+    for (k = 1; k < 16; k++) {
+        for (n = 0; n < 256; n++) {
+            uint64_t crc = crc64_slice_tab[k - 1][n];
+            crc64_slice_tab[k][n] = crc64_tab[(uint8_t)crc] ^ (crc >> 8);
+        }
+    }
+}
+
+static inline uint64_t crc64_load64(const unsigned char *s) {
+    return (uint64_t)s[0] | ((uint64_t)s[1] << 8) | ((uint64_t)s[2] << 16) | ((uint64_t)s[3] << 24) |
+        ((uint64_t)s[4] << 32) | ((uint64_t)s[5] << 40) | ((uint64_t)s[6] << 48) | ((uint64_t)s[7] << 56);
+}
+
+#define CRC64_SLICE8(t, crc) \
+    (t[7][(crc) & 0xff] ^ t[6][((crc) >> 8) & 0xff] ^ t[5][((crc) >> 16) & 0xff] ^ t[4][((crc) >> 24) & 0xff] ^ \
+     t[3][((crc) >> 32) & 0xff] ^ t[2][((crc) >> 40) & 0xff] ^ t[1][((crc) >> 48) & 0xff] ^ t[0][(crc) >> 56])
+
+static uint64_t crc64_slice8_run(uint64_t crc, const unsigned char *s, uint64_t l) {
+    while (l >= 8) {
+        crc ^= crc64_load64(s);
+        crc = CRC64_SLICE8(crc64_slice_tab, crc);
+        s += 8;
+        l -= 8;
+    }
+    return crc64_bytewise(crc, s, l);
+}
+
+static uint64_t crc64_slice16_run(uint64_t crc, const unsigned char *s, uint64_t l) {
+    while (l >= 16) {
+        uint64_t lo = crc ^ crc64_load64(s);
+        uint64_t hi = crc64_load64(s + 8);
+        crc = CRC64_SLICE8((crc64_slice_tab + 8), lo) ^ CRC64_SLICE8(crc64_slice_tab, hi);
+        s += 16;
+        l -= 16;
+    }
+    return crc64_slice8_run(crc, s, l);
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CRC64_HAVE_PCLMUL 1
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC64_TARGET_PCLMUL
+#else
+#include <cpuid.h>
+#define CRC64_TARGET_PCLMUL __attribute__((target("sse2,pclmul")))
+#endif
+
+/* Folding constants x^n mod P in the bit-reflected order used by the table (bit i holds
+ * the coefficient of x^(63-i)). Exponents are one less than the fold distance because a
+ * carry-less multiply of reflected operands yields the product times x. */
+static uint64_t crc64_fold_512[2], crc64_fold_384[2], crc64_fold_256[2], crc64_fold_128[2];
+
+static uint64_t crc64_xpow_mod(unsigned n) {
+    const uint64_t poly = UINT64_C(0xad93d23594c935a9);
+    uint64_t r = 1, rev = 0;
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        uint64_t carry = r >> 63;
+        r <<= 1;
+        if (carry) r ^= poly;
+    }
+    for (i = 0; i < 64; i++) {
+        rev |= ((r >> i) & 1) << (63 - i);
+    }
+    return rev;
+}
+
+static void crc64_pclmul_init(void) {
+    crc64_fold_512[0] = crc64_xpow_mod(512 + 64 - 1);
+    crc64_fold_512[1] = crc64_xpow_mod(512 - 1);
+    crc64_fold_384[0] = crc64_xpow_mod(384 + 64 - 1);
+    crc64_fold_384[1] = crc64_xpow_mod(384 - 1);
+    crc64_fold_256[0] = crc64_xpow_mod(256 + 64 - 1);
+    crc64_fold_256[1] = crc64_xpow_mod(256 - 1);
+    crc64_fold_128[0] = crc64_xpow_mod(128 + 64 - 1);
+    crc64_fold_128[1] = crc64_xpow_mod(128 - 1);
+}
+
+static int crc64_cpu_has_pclmul(void) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) != 0 && (info[3] & (1 << 26)) != 0;
+#else
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+    return (c & bit_PCLMUL) != 0 && (d & bit_SSE2) != 0;
+#endif
+}
+
+/* Moves x (16 message bytes still to be reduced) forward over dist bits and adds y. */
+CRC64_TARGET_PCLMUL static inline __m128i crc64_fold(__m128i x, __m128i k, __m128i y) {
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), y);
+}
+
+CRC64_TARGET_PCLMUL static uint64_t crc64_pclmul_run(uint64_t crc, const unsigned char *s, uint64_t l) {
+    if (l < 64) return crc64_slice16_run(crc, s, l);
+
+    __m128i k512 = _mm_set_epi64x((long long)crc64_fold_512[1], (long long)crc64_fold_512[0]);
+    __m128i k384 = _mm_set_epi64x((long long)crc64_fold_384[1], (long long)crc64_fold_384[0]);
+    __m128i k256 = _mm_set_epi64x((long long)crc64_fold_256[1], (long long)crc64_fold_256[0]);
+    __m128i k128 = _mm_set_epi64x((long long)crc64_fold_128[1], (long long)crc64_fold_128[0]);
+
+    __m128i x0 = _mm_loadu_si128((const __m128i *)s);
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(s + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(s + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(s + 48));
+    x0 = _mm_xor_si128(x0, _mm_set_epi64x(0, (long long)crc));
+    s += 64;
+    l -= 64;
+
+    while (l >= 64) {
+        x0 = crc64_fold(x0, k512, _mm_loadu_si128((const __m128i *)s));
+        x1 = crc64_fold(x1, k512, _mm_loadu_si128((const __m128i *)(s + 16)));
+        x2 = crc64_fold(x2, k512, _mm_loadu_si128((const __m128i *)(s + 32)));
+        x3 = crc64_fold(x3, k512, _mm_loadu_si128((const __m128i *)(s + 48)));
+        s += 64;
+        l -= 64;
+    }
+
+    __m128i x = crc64_fold(x0, k384, crc64_fold(x1, k256, crc64_fold(x2, k128, x3)));
+    while (l >= 16) {
+        x = crc64_fold(x, k128, _mm_loadu_si128((const __m128i *)s));
+        s += 16;
+        l -= 16;
+    }
+
+    /* x * x^64 mod P is the crc of the 16 bytes of x with a zero initial value. */
+    unsigned char rest[16];
+    _mm_storeu_si128((__m128i *)rest, x);
+    crc = crc64_slice16_run(0, rest, 16);
+    return crc64_slice16_run(crc, s, l);
+}
+#endif
+
+typedef uint64_t (*crc64_fn)(uint64_t crc, const unsigned char *s, uint64_t l);
+
+struct crc64_dispatch {
+    crc64_fn best;
+    int pclmul;
+
+    crc64_dispatch() {
+        crc64_slice_init();
+        best = crc64_slice16_run;
+        pclmul = 0;
+#ifdef CRC64_HAVE_PCLMUL
+        if (crc64_cpu_has_pclmul()) {
+            crc64_pclmul_init();
+            /* Only switch over if it agrees with the table on a few lengths and seeds. */
+            unsigned char buf[300];
+            int i, ok = 1;
+            for (i = 0; i < (int)sizeof(buf); i++) buf[i] = (unsigned char)(i * 131 + 7);
+            for (i = 60; i < (int)sizeof(buf) && ok; i += 7) {
+                uint64_t seed = UINT64_C(0x0123456789abcdef) * (uint64_t)i;
+                ok = crc64_pclmul_run(seed, buf, i) == crc64_bytewise(seed, buf, i);
+            }
+            if (ok) {
+                best = crc64_pclmul_run;
+                pclmul = 1;
+            }
+        }
+#endif
+    }
+};
+
+static const crc64_dispatch &crc64_get_dispatch(void) {
+    static crc64_dispatch dispatch;
+    return dispatch;
+}
+
+uint64_t crc64_slice8(uint64_t crc, const unsigned char *s, uint64_t l) {
+    crc64_get_dispatch();
+    return crc64_slice8_run(crc, s, l);
+}
+
+uint64_t crc64_slice16(uint64_t crc, const unsigned char *s, uint64_t l) {
+    crc64_get_dispatch();
+    return crc64_slice16_run(crc, s, l);
+}
+
+int crc64_pclmul_supported(void) {
+    return crc64_get_dispatch().pclmul;
+}
+
+uint64_t crc64_pclmul(uint64_t crc, const unsigned char *s, uint64_t l) {
+#ifdef CRC64_HAVE_PCLMUL
+    if (crc64_get_dispatch().pclmul) return crc64_pclmul_run(crc, s, l);
+#endif
+    return crc64_slice16(crc, s, l);
+}
+
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+    return crc64_get_dispatch().best(crc, s, l);
+}
@@ -3,6 +3,16 @@
 
 #include <cstdint>
 
+/* Picks the fastest variant below for this CPU on first use; all return identical results. */
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 
+uint64_t crc64_bytewise(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_slice8(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_slice16(uint64_t crc, const unsigned char *s, uint64_t l);
+
+/* Carry-less multiply folding (x86 PCLMULQDQ). Falls back to crc64_slice16() when the
+ * CPU lacks the instruction; crc64_pclmul_supported() tells which one runs. */
+uint64_t crc64_pclmul(uint64_t crc, const unsigned char *s, uint64_t l);
+int crc64_pclmul_supported(void);
+
 #endif
\ No newline at end of file
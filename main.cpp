@@ -1,5 +1,6 @@
 #define NOMINMAX 
 #include <cstdio>
+#include <cfloat>
 #include <tinyusdz.hh>
 #include <usdShade.hh>
 #include <usdSkel.hh>
@@ -19,13 +20,39 @@
 #include <gtc/quaternion.hpp>
 #include <gtx/matrix_decompose.hpp>
 #include <vector>
-#include <queue>
 #include <unordered_map>
 #include <filesystem>
-#include <crc64.h>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <algorithm>
+#include <map>
+#include <climits>
 #include <tydra/scene-access.hh>
 
 #include "Image.h"
+#include "usd2glb.h"
+#include "ThreadPool.h"
+#include "PrimIndex.h"
+#include "GlbWriter.h"
+#include "Weld.h"
+#include "VertexCache.h"
+#include "Quantize.h"
+#include "Meshopt.h"
+#include "Animation.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 namespace Mid
 {
@@ -61,1792 +88,2594 @@ namespace Mid
 		int idx_metallic_roughness = -1;
 		int idx_specular_glossiness = -1;
 	};
-}
-
-inline glm::mat4 mat_convert(const tinyusdz::value::matrix4d& mat)
-{
-	glm::mat4 mat_row = *(glm::dmat4*)(&mat);
-	return glm::transpose(mat_row);
-}
-
-#if 1
-
-#ifdef MAKE_A_DLL
-
-#define USD2GLB_EXPORTS
-
-#ifdef USD2GLB_EXPORTS
-#define USD2GLB_API extern "C" __declspec(dllexport)
-#else
-#define USD2GLB_API extern "C" __declspec(dllimport)
-#endif
-#else
-#define USD2GLB_API
-#endif
-
-USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
-{
-	std::string path_model = std::filesystem::path(usdPathInput).parent_path().u8string();
-
-	std::string warn;
-	std::string err;
 
-	tinyusdz::Stage stage;
-	tinyusdz::USDLoadOptions options;
-	options.max_image_width = options.max_image_height = 4096;
-	options.load_assets = false;
-	bool ret = tinyusdz::LoadUSDFromFile(usdPathInput, &stage, &warn, &err, options);
-	if (!ret)
+	// One output texture: the sources of a packed image (or a single source passed through),
+	// planned in material order so indices don't depend on which texture finishes first.
+	struct TextureJob
 	{
-		printf("%s\n", warn.c_str());
-		printf("%s\n", err.c_str());
-		return -1;
-	}
-
-	// tinyusdz::usda::SaveAsUSDA("output.usda", stage, &warn, &err);
-	
-	double time_codes_per_sec = stage.metas().timeCodesPerSecond.get_value();
-	auto upAxis = stage.metas().upAxis.get_value();
+		enum Kind
+		{
+			DIFFUSE_ALPHA,
+			EMISSIVE,
+			SPECULAR_GLOSSINESS,
+			METALLIC_ROUGHNESS,
+		};
+
+		Kind kind;
+		std::string tex0;
+		std::string tex1;
+		float roughness = 1.0f;
+	};
 
-	glm::quat axis_rot = glm::identity<glm::quat>();
-	if (upAxis == tinyusdz::Axis::X)
-	{
-		glm::mat4 rot = { 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
-		axis_rot = rot;
-	}
-	else if (upAxis == tinyusdz::Axis::Z)
+	// What the geometry of one GeomMesh needs, gathered during traversal so that
+	// converting it touches no shared state.
+	struct MeshJob
 	{
-		glm::mat4 rot = { 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
-		axis_rot = rot;
-	}
-	
-	tinyusdz::Prim* root_prim = &stage.root_prims()[0];
-	
-	tinygltf::Model m_out;	
-	m_out.scenes.resize(1);
-	tinygltf::Scene& scene_out = m_out.scenes[0];
-	scene_out.name = "Scene";
+		const tinyusdz::GeomMesh* mesh_in = nullptr;
+		int mesh_id = -1;
+		int node_id = -1;
+		int idx_material = -1;
+		std::string uvset;
+		std::vector<const tinyusdz::BlendShape*> blend_shapes;
+	};
 
-	m_out.asset.version = "2.0";
-	m_out.asset.generator = "tinygltf";
+	// Bytes written for one kind of attribute with KHR_mesh_quantization, against 32-bit
+	// floats, and the largest difference between a decoded and an input component.
+	struct QuantizeStat
+	{
+		size_t bytes_float = 0;
+		size_t bytes_out = 0;
+		double max_error = 0.0;
+	};
 
-	m_out.buffers.resize(1);
-	tinygltf::Buffer& buf_out = m_out.buffers[0];
+	// A buffer view of a converted mesh encoded with EXT_meshopt_compression. Offsets are
+	// relative to the mesh's own buffer data until it is merged.
+	struct MeshoptView
+	{
+		int view = -1;
+		bool triangles = false;		// TRIANGLES index data, ATTRIBUTES otherwise
+		size_t stride = 0;
+		size_t count = 0;
+		size_t offset = 0;			// of the encoded data in the BIN buffer
+		size_t length = 0;
+		size_t fallback_offset = 0;	// of the decoded data in the fallback buffer, without --meshopt-fallback
+	};
 
-	size_t offset = 0;
-	size_t length = 0;
-	size_t view_id = 0;
-	size_t acc_id = 0;
+	// What converting one mesh produces besides its glTF data: the transform its node needs
+	// to dequantize positions, the views to mark as compressed, and statistics printed with
+	// --report once the mesh is merged.
+	struct MeshInfo
+	{
+		float dequant_scale = 0.0f;
+		glm::vec3 dequant_offset = glm::vec3(0.0f);
+
+		std::vector<MeshoptView> meshopt_views;
+		size_t fallback_size = 0;
+		size_t meshopt_bytes_in = 0;
+		size_t meshopt_bytes_out = 0;
+		double meshopt_seconds = 0.0;
+
+		// Blend shape i of the mesh became morph target target_remap[i], -1 if it moved nothing.
+		// Empty when the mesh has no blend shapes.
+		std::vector<int> target_remap;
+
+		size_t num_tris = 0;
+		bool cache_optimized = false;
+		VertexCacheStats cache_before;
+		VertexCacheStats cache_after;
+		std::map<std::string, QuantizeStat> quantize_stats;
+	};
 
-	std::vector<Mid::Material> material_lst;
-	std::unordered_map<std::string, int> material_map;
+	// One animation channel and its sampler, built by a worker and written to the glTF and
+	// the BIN buffer when its animation is merged.
+	struct StagedChannel
+	{
+		int node = -1;
+		const char* path = nullptr;		// "translation", "rotation" or "weights"
+		bool step = false;
+		std::vector<float> times;
+		std::vector<uint8_t> output;	// count sampler output elements of type and component_type
+		size_t count = 0;
+		int type = TINYGLTF_TYPE_SCALAR;
+		int component_type = TINYGLTF_COMPONENT_TYPE_FLOAT;
+		double quantize_error = 0.0;
+	};
 
-	struct Prim
+	// What building one SkelAnimation produces: its channels in output order, and statistics
+	// added up for --report once it is merged.
+	struct StagedAnimation
 	{
-		tinyusdz::Prim* prim;
-		int id_node_base = -1;
-		std::string base_path;
-		int idx_material = -1;
-		std::string skel_path;
+		std::string name;
+		std::vector<StagedChannel> channels;
+		size_t num_keys_in = 0;
+		size_t num_keys_out = 0;
 	};
 
-	std::queue<Prim> queue_prim;
+	// One vertex attribute of a primitive. data must stay valid until the attribute is written.
+	struct VertexAttrib
+	{
+		std::string name;
+		const void* data;
+		size_t count;
+		size_t size;			// bytes per element, a multiple of 4
+		int type;
+		int component_type;
+		std::vector<double> min_values;
+		std::vector<double> max_values;
+		bool normalized = false;
+	};
 
-	bool specular_used = false;
+	// One blend shape as the vertices it moves, in increasing order, and their deltas.
+	struct MorphTarget
+	{
+		std::vector<int> indices;
+		std::vector<glm::vec3> offsets;
+		std::vector<glm::vec3> norm_offsets;	// empty without normals
+	};
 
-	queue_prim.push({ root_prim, -1, "" });
-	while (!queue_prim.empty())
+	// Triangles and per-vertex data of one output primitive, indexed by the same vertex ids.
+	struct PrimitiveData
 	{
-		Prim prim = queue_prim.front();
-		queue_prim.pop();
-		std::string path = prim.base_path + "/" + prim.prim->element_path().full_path_name();
+		std::vector<tinyusdz::value::point3f> points;
+		std::vector<glm::vec3> norms;
+		std::vector<std::vector<glm::vec2>> uvs;	// TEXCOORD_n, flipped to glTF orientation
+		std::vector<glm::vec3> colors;
+		std::vector<glm::u8vec4> joints;
+		std::vector<glm::vec4> weights;
+		std::vector<glm::ivec3> faces;
+		glm::vec3 lower = glm::vec3(0.0f);
+		glm::vec3 upper = glm::vec3(0.0f);
+
+		std::vector<MorphTarget> targets;
+
+		// With KHR_mesh_quantization, positions are written normalized to [-1, 1] around
+		// dequant_offset and scaled back by the node. 0 keeps them as floats.
+		float dequant_scale = 0.0f;
+		glm::vec3 dequant_offset = glm::vec3(0.0f);
+	};
 
-		if (prim.prim->data().type_id() == tinyusdz::value::TYPE_ID_MATERIAL)
+	// A float primvar of a mesh (normals, a uv set, displayColor) with its interpolation,
+	// looked up per face-vertex.
+	struct Primvar
+	{
+		enum Target { NORMAL, TEXCOORD, COLOR };
+		Target target;
+		int num_comps = 0;
+		std::vector<float> values;
+		std::vector<int> indices;
+		tinyusdz::Interpolation interpolation = tinyusdz::Interpolation::Vertex;
+
+		// Values that differ between the face-vertices of one point.
+		bool PerCorner() const
 		{
-			Mid::Material material_mid;
-
-			auto* material_in = prim.prim->data().as<tinyusdz::Material>();
-			material_mid.name = material_in->name;
-			const std::vector<tinyusdz::Path>& connections = material_in->surface.get_connections();
-			auto ppath = connections[0].get_parent_path();
-			nonstd::expected<const tinyusdz::Prim*, std::string> pshader0 = stage.GetPrimAtPath(ppath);
-			const tinyusdz::Prim* prim = pshader0.value();
-			auto* shader0 = prim->data().as<tinyusdz::Shader>();
-			auto* surface = shader0->value.as<tinyusdz::UsdPreviewSurface>();
+			return interpolation == tinyusdz::Interpolation::FaceVarying || interpolation == tinyusdz::Interpolation::Uniform;
+		}
 
-			int useSpecularWorkflow;
-			surface->useSpecularWorkflow.get_value().get_scalar(&useSpecularWorkflow);			
-			material_mid.useSpecularWorkflow = useSpecularWorkflow != 0;		
+		size_t Element(size_t corner, int point, size_t face) const
+		{
+			size_t idx = (size_t)point;
+			if (interpolation == tinyusdz::Interpolation::FaceVarying) idx = corner;
+			else if (interpolation == tinyusdz::Interpolation::Uniform) idx = face;
+			else if (interpolation == tinyusdz::Interpolation::Constant) idx = 0;
+			if (indices.size() > 0) idx = (size_t)indices[idx];
+			return idx;
+		}
 
-			specular_used = specular_used || material_mid.useSpecularWorkflow;
+		const float* Value(size_t corner, int point, size_t face) const
+		{
+			return &values[Element(corner, point, face) * num_comps];
+		}
 
+		// Checks that every lookup stays inside values.
+		bool Valid(size_t num_points, size_t num_corners, size_t num_faces) const
+		{
+			if (num_comps <= 0) return false;
+			size_t num_elems = values.size() / num_comps;
+			size_t needed = num_points;
+			if (interpolation == tinyusdz::Interpolation::FaceVarying) needed = num_corners;
+			else if (interpolation == tinyusdz::Interpolation::Uniform) needed = num_faces;
+			else if (interpolation == tinyusdz::Interpolation::Constant) needed = 1;
+
+			if (indices.size() == 0) return num_elems >= needed;
+			if (indices.size() < needed) return false;
+			for (size_t i = 0; i < needed; i++)
 			{
-				auto diffuse = surface->diffuseColor;
-				auto diffuse_connection = diffuse.get_connection();
-
-				if (diffuse_connection.has_value())
-				{
-					std::string path = diffuse_connection.value().prim_part();
-					const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
-					auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
-					if (shader1->value.type_id() == tinyusdz::value::TYPE_ID_IMAGING_UVTEXTURE)
-					{
-						auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
-						tinyusdz::value::AssetPath file;
-						tex->file.get_value().value().get_scalar(&file);
-						material_mid.diffuse_tex = file.GetAssetPath();
+				if (indices[i] < 0 || (size_t)indices[i] >= num_elems) return false;
+			}
+			return true;
+		}
+	};
 
-						auto uv_connection = tex->st.get_connection();
-						if (uv_connection.has_value())
-						{
-							std::string path_uv = uv_connection.value().prim_part();
-							const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
-							const tinyusdz::Shader* shader2 = pshader2->data().as<tinyusdz::Shader>();
-							auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
-							
-							if (uvset->varname.is_connection() == true)
-							{
-								nonstd::optional<tinyusdz::Path> varname_connectionOpt = uvset->varname.get_connection();
-								if (varname_connectionOpt.has_value())
-								{
-									tinyusdz::Path varname_connection = varname_connectionOpt.value();
-									std::string path_varname = varname_connection.prim_part();
-									std::string prop = varname_connection.prop_part();
-									const tinyusdz::Prim* prim_varname = stage.GetPrimAtPath(tinyusdz::Path(path_varname, "")).value();
-									auto* material_inB = prim_varname->data().as<tinyusdz::Material>();
-									if (material_inB)
-									{
-										auto propPairIt = material_inB->props.find(prop);
-										if (propPairIt != std::end(material_inB->props))
-										{
-											tinyusdz::Property property = propPairIt->second;
-											if (property.is_attribute())
-											{
-												tinyusdz::Attribute attribute = property.get_attribute();
-												tinyusdz::value::token propToken = attribute.get_value<tinyusdz::value::token>().value();
-												material_mid.uvset = propToken.str();
-											}
-										}
-									}
-								}
-							}
-							else
-							{
-							tinyusdz::value::token token_uv;
-							uvset->varname.get_value().value().get_scalar(&token_uv);
-							material_mid.uvset = token_uv.str();
-							}
-						}
-					}
-					else if (shader1->value.type_id() == tinyusdz::value::TYPE_ID_IMAGING_PRIMVAR_READER_FLOAT3)
-					{
-						auto* reader = shader1->value.as<tinyusdz::UsdPrimvarReader_float3>();						
-						tinyusdz::value::token varname;
-						reader->varname.get_value().value().get_scalar(&varname);
-						material_mid.diffuse_varname = varname.str();
-					}
-					material_mid.diffuse_color = { 1.0f, 1.0f, 1.0f };
-				}
-				else
-				{
-					tinyusdz::value::color3f col;
-					diffuse.get_value().get_scalar(&col);
-					material_mid.diffuse_color = { col[0], col[1], col[2] };
-				}
+	// Decoded textures kept across conversions in a long-lived process. Entries are keyed by
+	// file path and dropped when the file's size or write time changes.
+	class ImageCache
+	{
+	public:
+		explicit ImageCache(size_t capacity) : capacity(capacity) {}
 
+		void Load(Image& img, const std::string& filename)
+		{
+			std::error_code ec;
+			auto mtime = std::filesystem::last_write_time(filename, ec);
+			uintmax_t size = ec ? 0 : std::filesystem::file_size(filename, ec);
+			if (ec)
+			{
+				img.Load(filename.c_str());
+				return;
 			}
 
 			{
-				auto emissive = surface->emissiveColor;
-				auto emissive_connection = emissive.get_connection();
-				if (emissive_connection.has_value())
+				std::unique_lock<std::mutex> lock(mutex);
+				auto iter = index.find(filename);
+				if (iter != index.end())
 				{
-					std::string path = emissive_connection.value().prim_part();
-					const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
-					auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
-					auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
-					tinyusdz::value::AssetPath file;
-					tex->file.get_value().value().get_scalar(&file);
-					material_mid.emissive_tex = file.GetAssetPath();
-
-					auto uv_connection = tex->st.get_connection();
-					if (uv_connection.has_value())
+					auto entry = iter->second;
+					if (entry->size == size && entry->mtime == mtime)
 					{
-						std::string path_uv = uv_connection.value().prim_part();
-						const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
-						auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
-						auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
-						tinyusdz::value::token token_uv;
-						uvset->varname.get_value().value().get_scalar(&token_uv);
-						material_mid.uvset = token_uv.str();
+						lru.splice(lru.begin(), lru, entry);
+						img = entry->img;
+						return;
 					}
-					material_mid.emissive_color = { 1.0f, 1.0f, 1.0f };
-				}
-				else
-				{
-					tinyusdz::value::color3f col;
-					emissive.get_value().get_scalar(&col);
-					material_mid.emissive_color = { col[0], col[1], col[2] };
+					used -= entry->img.pixels.size() + entry->img.code.size();
+					lru.erase(entry);
+					index.erase(iter);
 				}
 			}
 
-			if (material_mid.useSpecularWorkflow)
-			{
-				auto specular = surface->specularColor;
-				auto specular_connection = specular.get_connection();
-				if (specular_connection.has_value())
-				{
-					std::string path = specular_connection.value().prim_part();
-					const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
-					auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
-					auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
-					tinyusdz::value::AssetPath file;
-					tex->file.get_value().value().get_scalar(&file);
-					material_mid.specular_tex = file.GetAssetPath();
+			img.Load(filename.c_str());
+			if (img.width < 0) return;
 
-					auto uv_connection = tex->st.get_connection();
-					if (uv_connection.has_value())
-					{
-						std::string path_uv = uv_connection.value().prim_part();
-						const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
-						auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
-						auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
-						tinyusdz::value::token token_uv;
-						uvset->varname.get_value().value().get_scalar(&token_uv);
-						material_mid.uvset = token_uv.str();
-					}
-					material_mid.specular_color = { 1.0f, 1.0f, 1.0f };
-				}			
-				else
-				{
-					tinyusdz::value::color3f col;
-					specular.get_value().get_scalar(&col);
-					material_mid.specular_color = { col[0], col[1], col[2] };
-				}
-			}
-			else
+			std::unique_lock<std::mutex> lock(mutex);
+			if (index.find(filename) != index.end()) return;
+			lru.push_front({ filename, size, mtime, img });
+			index[filename] = lru.begin();
+			used += img.pixels.size() + img.code.size();
+			while (used > capacity && lru.size() > 1)
 			{
-				auto metallic = surface->metallic;
-				auto metallic_connection = metallic.get_connection();
-				if (metallic_connection.has_value())
-				{
-					std::string path = metallic_connection.value().prim_part();
-					const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
-					auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
-					auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
-					tinyusdz::value::AssetPath file;
-					tex->file.get_value().value().get_scalar(&file);
-					material_mid.metallic_tex = file.GetAssetPath();
-					material_mid.metallic = 1.0f;
-
-					auto uv_connection = tex->st.get_connection();
-					if (uv_connection.has_value())
-					{
-						std::string path_uv = uv_connection.value().prim_part();
-						const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
-						auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
-						auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
-						tinyusdz::value::token token_uv;
-						uvset->varname.get_value().value().get_scalar(&token_uv);
-						material_mid.uvset = token_uv.str();
-					}
-				}
-				else
-				{
-					metallic.get_value().get_scalar(&material_mid.metallic);
-				}
+				Entry& last = lru.back();
+				used -= last.img.pixels.size() + last.img.code.size();
+				index.erase(last.filename);
+				lru.pop_back();
 			}
+		}
+
+	private:
+		struct Entry
+		{
+			std::string filename;
+			uintmax_t size;
+			std::filesystem::file_time_type mtime;
+			Image img;
+		};
+
+		std::list<Entry> lru;
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;
+		size_t used = 0;
+		size_t capacity;
+		std::mutex mutex;
+	};
+
+	struct TextureResolver
+	{
+		std::string base_dir;
+		usd2glb_resolve_fn resolve = nullptr;
+		void* user_data = nullptr;
+		ImageCache* cache = nullptr;
+
+		// Textures are decoded on several threads; calls into resolve are serialized so the
+		// callback doesn't need to be thread-safe.
+		mutable std::mutex resolve_mutex;
+
+		void Load(Image& img, const std::string& asset_path) const
+		{
+			if (resolve != nullptr)
 			{
-				auto roughness = surface->roughness;
-				auto roughness_connection = roughness.get_connection();
-				if (roughness_connection.has_value())
+				const unsigned char* data = nullptr;
+				size_t size = 0;
+				int ret;
 				{
-					std::string path = roughness_connection.value().prim_part();
-					const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
-					auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
-					auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
-					tinyusdz::value::AssetPath file;
-					tex->file.get_value().value().get_scalar(&file);
-					material_mid.roughness_tex = file.GetAssetPath();
-					material_mid.roughness = 1.0f;
-
-					auto uv_connection = tex->st.get_connection();
-					if (uv_connection.has_value())
-					{
-						std::string path_uv = uv_connection.value().prim_part();
-						const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
-						auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
-						auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
-						tinyusdz::value::token token_uv;
-						uvset->varname.get_value().value().get_scalar(&token_uv);
-						material_mid.uvset = token_uv.str();
-					}
+					std::unique_lock<std::mutex> lock(resolve_mutex);
+					ret = resolve(asset_path.c_str(), user_data, &data, &size);
 				}
-				else
+				if (ret == 0 && data != nullptr)
 				{
-					roughness.get_value().get_scalar(&material_mid.roughness);
+					img.Load(asset_path.c_str(), data, size);
 				}
+				return;
 			}
+			if (cache != nullptr)
 			{
-				auto opacity = surface->opacity;
-				auto opacity_connection = opacity.get_connection();
-				if (opacity_connection.has_value())
-				{
-					std::string path = opacity_connection.value().prim_part();
-					const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
-					auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
-					auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
-					tinyusdz::value::AssetPath file;
-					tex->file.get_value().value().get_scalar(&file);
-					material_mid.opacity_tex = file.GetAssetPath();
-					material_mid.opacity = 1.0f;
+				cache->Load(img, base_dir + "/" + asset_path);
+				return;
+			}
+			img.Load((base_dir + "/" + asset_path).c_str());
+		}
+	};
 
-					auto uv_connection = tex->st.get_connection();
-					if (uv_connection.has_value())
-					{
-						std::string path_uv = uv_connection.value().prim_part();
-						const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
-						auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
-						auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
-						tinyusdz::value::token token_uv;
-						uvset->varname.get_value().value().get_scalar(&token_uv);
-						material_mid.uvset = token_uv.str();
-					}
-				}
-				else
-				{
-					opacity.get_value().get_scalar(&material_mid.opacity);					
-				}
+	struct StageTimer
+	{
+		bool enabled = false;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
 
+		void Lap(const char* name)
+		{
+			auto t1 = std::chrono::steady_clock::now();
+			if (enabled)
+			{
+				printf("  %-12s %9.2fms\n", name, std::chrono::duration<double, std::milli>(t1 - t0).count());
 			}
+			t0 = t1;
+		}
+	};
+}
+
+inline glm::mat4 mat_convert(const tinyusdz::value::matrix4d& mat)
+{
+	glm::mat4 mat_row = *(glm::dmat4*)(&mat);
+	return glm::transpose(mat_row);
+}
 
-			int idx = (int)material_lst.size();
-			material_lst.push_back(material_mid);
-			material_map[path] = idx;
+#if 1
+
+// Writes the vertex attributes of prim_out, each into its own buffer view, or with
+// interleave into a single view with byteStride set. Attributes whose count differs from the
+// first one's always get their own view.
+static void usd2glb_attributes(const std::vector<Mid::VertexAttrib>& attribs, bool interleave, tinygltf::Model& m_out, tinygltf::Primitive& prim_out, Mid::BufferPlan& plan_out)
+{
+	size_t offset = 0;
+	size_t length = 0;
+	size_t view_id = 0;
+	size_t acc_id = 0;
 
+	size_t num_verts = attribs.size() > 0 ? attribs[0].count : 0;
+	size_t stride = 0;
+	std::vector<size_t> attrib_offsets(attribs.size(), 0);
+	if (interleave)
+	{
+		for (size_t i = 0; i < attribs.size(); i++)
+		{
+			if (attribs[i].count != num_verts) continue;
+			attrib_offsets[i] = stride;
+			stride += attribs[i].size;
 		}
+	}
 
-		if (prim.prim->data().type_id() != tinyusdz::value::TYPE_ID_MATERIAL
-			&& prim.prim->data().type_id() != tinyusdz::value::TYPE_ID_GEOM_MESH)
-		{			
-			size_t num_children = prim.prim->children().size();
-			for (size_t i = 0; i < num_children; i++)
+	size_t interleaved_view = 0;
+	if (stride > 0)
+	{
+		length = stride * num_verts;
+		uint8_t* p_out = plan_out.Reserve(length, &offset);
+		for (size_t i = 0; i < attribs.size(); i++)
+		{
+			const Mid::VertexAttrib& attrib = attribs[i];
+			if (attrib.count != num_verts) continue;
+			const uint8_t* p_in = (const uint8_t*)attrib.data;
+			for (size_t j = 0; j < num_verts; j++)
 			{
-				queue_prim.push({ &prim.prim->children()[i], -1, path });
+				memcpy(p_out + j * stride + attrib_offsets[i], p_in + j * attrib.size, attrib.size);
 			}
 		}
+
+		interleaved_view = m_out.bufferViews.size();
+		{
+			tinygltf::BufferView view;
+			view.buffer = 0;
+			view.byteOffset = offset;
+			view.byteLength = length;
+			view.byteStride = stride;
+			view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
+			m_out.bufferViews.push_back(view);
+		}
 	}
 
-	if (specular_used)
+	for (size_t i = 0; i < attribs.size(); i++)
 	{
-		m_out.extensionsUsed.push_back("KHR_materials_pbrSpecularGlossiness");
-	}
+		const Mid::VertexAttrib& attrib = attribs[i];
+		bool in_stride = stride > 0 && attrib.count == num_verts;
 
-	std::unordered_map<std::string, int> joint_map;
-	std::unordered_map<int, std::string> node_skin_map;
-	std::unordered_map<std::string, int> skin_map;
+		if (in_stride)
+		{
+			view_id = interleaved_view;
+		}
+		else
+		{
+			length = attrib.size * attrib.count;
+			offset = plan_out.Add(attrib.data, length);
 
-	struct MorphIdx
+			// Elements padded to 4 bytes (quantized VEC3s) need an explicit stride.
+			size_t packed_size = tinygltf::GetComponentSizeInBytes(attrib.component_type) * tinygltf::GetNumComponentsInType(attrib.type);
+
+			view_id = m_out.bufferViews.size();
+			{
+				tinygltf::BufferView view;
+				view.buffer = 0;
+				view.byteOffset = offset;
+				view.byteLength = length;
+				if (attrib.size != packed_size) view.byteStride = attrib.size;
+				view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
+				m_out.bufferViews.push_back(view);
+			}
+		}
+
+		acc_id = m_out.accessors.size();
+		{
+			tinygltf::Accessor acc;
+			acc.bufferView = view_id;
+			acc.byteOffset = in_stride ? attrib_offsets[i] : 0;
+			acc.type = attrib.type;
+			acc.componentType = attrib.component_type;
+			acc.normalized = attrib.normalized;
+			acc.count = attrib.count;
+			acc.minValues = attrib.min_values;
+			acc.maxValues = attrib.max_values;
+			m_out.accessors.push_back(acc);
+		}
+
+		prim_out.attributes[attrib.name] = acc_id;
+	}
+}
+
+static void usd2glb_triangulate(const std::vector<int>& faceVertexCounts, const std::vector<int>& faceVertexIndices, bool leftHand, std::vector<glm::ivec3>& faces)
+{
+	size_t idx_ind = 0;
+	for (size_t i = 0; i < faceVertexCounts.size(); i++)
 	{
-		int node_idx;
-		int morph_idx;
-	};
+		int count = faceVertexCounts[i];
+		if (count == 3)
+		{
+			glm::ivec3 face;
+			if (leftHand)
+			{
+				face.z = faceVertexIndices[idx_ind]; idx_ind++;
+				face.y = faceVertexIndices[idx_ind]; idx_ind++;
+				face.x = faceVertexIndices[idx_ind]; idx_ind++;
+			}
+			else
+			{
+				face.x = faceVertexIndices[idx_ind]; idx_ind++;
+				face.y = faceVertexIndices[idx_ind]; idx_ind++;
+				face.z = faceVertexIndices[idx_ind]; idx_ind++;
+			}
+			faces.push_back(face);
+		}
+		else if (count == 4)
+		{
+			glm::ivec3 face1;
+			if (leftHand)
+			{
+				face1.z = faceVertexIndices[idx_ind]; idx_ind++;
+				face1.y = faceVertexIndices[idx_ind]; idx_ind++;
+				face1.x = faceVertexIndices[idx_ind]; idx_ind++;
+			}
+			else
+			{
+				face1.x = faceVertexIndices[idx_ind]; idx_ind++;
+				face1.y = faceVertexIndices[idx_ind]; idx_ind++;
+				face1.z = faceVertexIndices[idx_ind]; idx_ind++;
+			}
+			faces.push_back(face1);
 
-	std::unordered_map<std::string, std::vector<MorphIdx>> morph_map;
-	std::unordered_map<int, int> target_counts;
+			glm::ivec3 face2;
+			face2.x = face1.z;
+			face2.y = faceVertexIndices[idx_ind]; idx_ind++;
+			face2.z = face1.x;
+			faces.push_back(face2);
+		}
+	}
+}
+
+// Writes the triangles of prim with the narrowest index type that holds its vertex count.
+// The largest value of each type is left out, as glTF reserves it for primitive restart.
+static void usd2glb_indices(const Mid::PrimitiveData& prim, bool allow_u8, tinygltf::Model& m_out, tinygltf::Primitive& prim_out, Mid::BufferPlan& plan_out)
+{
+	size_t offset = 0;
+	size_t length = 0;
+	size_t view_id = 0;
+	size_t acc_id = 0;
+
+	size_t num_verts = prim.points.size();
+	size_t num_indices = prim.faces.size() * 3;
+	const int* p_in = (const int*)prim.faces.data();
+
+	int component_type;
+	if (num_verts <= 0xff && allow_u8)
+	{
+		component_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+		length = num_indices;
+		uint8_t* p_out = plan_out.Reserve(length, &offset);
+		for (size_t i = 0; i < num_indices; i++) p_out[i] = (uint8_t)p_in[i];
+	}
+	else if (num_verts <= 0xffff)
+	{
+		component_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+		length = num_indices * sizeof(uint16_t);
+		uint16_t* p_out = (uint16_t*)plan_out.Reserve(length, &offset);
+		for (size_t i = 0; i < num_indices; i++) p_out[i] = (uint16_t)p_in[i];
+	}
+	else
+	{
+		component_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+		length = num_indices * sizeof(uint32_t);
+		offset = plan_out.Add(p_in, length);
+	}
+
+	view_id = m_out.bufferViews.size();
+	{
+		tinygltf::BufferView view;
+		view.buffer = 0;
+		view.byteOffset = offset;
+		view.byteLength = length;
+		view.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+		m_out.bufferViews.push_back(view);
+	}
+
+	acc_id = m_out.accessors.size();
+	{
+		tinygltf::Accessor acc;
+		acc.bufferView = view_id;
+		acc.byteOffset = 0;
+		acc.type = TINYGLTF_TYPE_SCALAR;
+		acc.componentType = component_type;
+		acc.count = num_indices;
+		m_out.accessors.push_back(acc);
+	}
+
+	prim_out.indices = acc_id;
+}
+
+// Sorts the entries of target by vertex, as sparse accessors require. Of a vertex listed
+// twice, the last entry is kept.
+static void usd2glb_sort_target(Mid::MorphTarget& target)
+{
+	bool sorted = true;
+	for (size_t i = 1; i < target.indices.size() && sorted; i++)
+	{
+		sorted = target.indices[i - 1] < target.indices[i];
+	}
+	if (sorted) return;
+
+	std::vector<int> order(target.indices.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return target.indices[a] < target.indices[b]; });
+
+	bool has_normals = target.norm_offsets.size() > 0;
+	Mid::MorphTarget target_out;
+	target_out.indices.reserve(order.size());
+	target_out.offsets.reserve(order.size());
+	if (has_normals) target_out.norm_offsets.reserve(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		int e = order[i];
+		if (target_out.indices.size() == 0 || target_out.indices.back() != target.indices[e])
+		{
+			target_out.indices.push_back(target.indices[e]);
+			target_out.offsets.push_back(target.offsets[e]);
+			if (has_normals) target_out.norm_offsets.push_back(target.norm_offsets[e]);
+		}
+		else
+		{
+			target_out.offsets.back() = target.offsets[e];
+			if (has_normals) target_out.norm_offsets.back() = target.norm_offsets[e];
+		}
+	}
+	target = std::move(target_out);
+}
+
+// Moves the entries of target to the vertices remap gives them, dropping the ones remapped to -1.
+static void usd2glb_remap_target(const Mid::MorphTarget& target, const std::vector<int>& remap, Mid::MorphTarget& target_out)
+{
+	bool has_normals = target.norm_offsets.size() > 0;
+	target_out = Mid::MorphTarget();
+	for (size_t i = 0; i < target.indices.size(); i++)
+	{
+		int v = remap[target.indices[i]];
+		if (v < 0) continue;
+		target_out.indices.push_back(v);
+		target_out.offsets.push_back(target.offsets[i]);
+		if (has_normals) target_out.norm_offsets.push_back(target.norm_offsets[i]);
+	}
+	usd2glb_sort_target(target_out);
+}
+
+// Splits prim into pieces of at most max_verts vertices, walking the triangles in order and
+// starting a new piece when the next triangle's vertices no longer fit.
+static void usd2glb_split(const Mid::PrimitiveData& prim, size_t max_verts, std::vector<Mid::PrimitiveData>& pieces)
+{
+	size_t num_verts = prim.points.size();
+	std::vector<int> piece_of(num_verts, -1);
+	std::vector<int> local_idx(num_verts, 0);
+	std::vector<std::vector<int>> piece_verts;
 
-	queue_prim.push({ root_prim, -1, "" });
-	while (!queue_prim.empty())
+	for (size_t i = 0; i < prim.faces.size(); i++)
 	{
-		Prim prim = queue_prim.front();
-		queue_prim.pop();
-		std::string path = prim.base_path + "/" + prim.prim->element_path().full_path_name();
+		const glm::ivec3& face = prim.faces[i];
+		int cur = (int)pieces.size() - 1;
+
+		size_t num_new = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			if (cur < 0 || piece_of[face[k]] != cur) num_new++;
+		}
+		if (cur < 0 || piece_verts[cur].size() + num_new > max_verts)
+		{
+			pieces.emplace_back();
+			piece_verts.emplace_back();
+			cur++;
+		}
 
-		if (prim.prim->data().type_id() == tinyusdz::value::TYPE_ID_GEOM_XFORM)
+		glm::ivec3 face_out;
+		for (int k = 0; k < 3; k++)
 		{
-			auto* node_in = prim.prim->data().as<tinyusdz::Xform>();			
-			if (node_in->materialBinding.has_value())
+			int v = face[k];
+			if (piece_of[v] != cur)
 			{
-				std::string material_path = node_in->materialBinding.value().targetPath.full_path_name();				
-				prim.idx_material = material_map[material_path];				
+				piece_of[v] = cur;
+				local_idx[v] = (int)piece_verts[cur].size();
+				piece_verts[cur].push_back(v);
 			}
+			face_out[k] = local_idx[v];
+		}
+		pieces[cur].faces.push_back(face_out);
+	}
 
+	// Vertex of the current piece each vertex of prim becomes, -1 if it isn't in the piece.
+	std::vector<int> remap(num_verts, -1);
+	for (size_t p = 0; p < pieces.size(); p++)
+	{
+		Mid::PrimitiveData& piece = pieces[p];
+		const std::vector<int>& verts = piece_verts[p];
 
-			int node_id = (int)m_out.nodes.size();
+		piece.dequant_scale = prim.dequant_scale;
+		piece.dequant_offset = prim.dequant_offset;
 
-			tinygltf::Node node_out;
-			node_out.name = node_in->name;
+		piece.lower = glm::vec3(FLT_MAX);
+		piece.upper = glm::vec3(-FLT_MAX);
+		for (size_t i = 0; i < verts.size(); i++)
+		{
+			int v = verts[i];
+			auto pos = prim.points[v];
+			piece.points.push_back(pos);
+			piece.lower = glm::min(piece.lower, glm::vec3(pos[0], pos[1], pos[2]));
+			piece.upper = glm::max(piece.upper, glm::vec3(pos[0], pos[1], pos[2]));
+
+			if (prim.norms.size() == num_verts) piece.norms.push_back(prim.norms[v]);
+			for (size_t j = 0; j < prim.uvs.size(); j++)
+			{
+				if (piece.uvs.size() <= j) piece.uvs.resize(j + 1);
+				piece.uvs[j].push_back(prim.uvs[j][v]);
+			}
+			if (prim.colors.size() == num_verts) piece.colors.push_back(prim.colors[v]);
+			if (prim.joints.size() == num_verts)
+			{
+				piece.joints.push_back(prim.joints[v]);
+				piece.weights.push_back(prim.weights[v]);
+			}
+			remap[v] = (int)i;
+		}
 
-			tinyusdz::value::matrix4d matrix;
-			node_in->EvaluateXformOps(0.0, tinyusdz::value::TimeSampleInterpolationType::Linear, &matrix, nullptr, nullptr);
+		piece.targets.resize(prim.targets.size());
+		for (size_t j = 0; j < prim.targets.size(); j++)
+		{
+			usd2glb_remap_target(prim.targets[j], remap, piece.targets[j]);
+		}
+		for (size_t i = 0; i < verts.size(); i++)
+		{
+			remap[verts[i]] = -1;
+		}
+	}
+}
 
-			glm::mat4 mat = mat_convert(matrix);
-			glm::vec3 scale;
-			glm::quat rotation;
-			glm::vec3 translation;
+// Moves values[i] to values[remap[i]], dropping the ones remapped to -1. Streams that aren't
+// per vertex (empty ones) are left alone.
+template<typename T>
+static void usd2glb_remap(std::vector<T>& values, const std::vector<int>& remap, size_t num_verts)
+{
+	if (values.size() != remap.size()) return;
+	std::vector<T> values_out(num_verts);
+	for (size_t i = 0; i < remap.size(); i++)
+	{
+		if (remap[i] >= 0) values_out[remap[i]] = values[i];
+	}
+	values.swap(values_out);
+}
 
-			glm::vec3 skew;
-			glm::vec4 persp;
-			glm::decompose(mat, scale, rotation, translation, skew, persp);
+// Renumbers the vertices of prim in first-use order of its triangles and drops unreferenced
+// ones, in every vertex stream and morph target.
+static void usd2glb_reorder_vertices(Mid::PrimitiveData& prim)
+{
+	if (prim.faces.size() == 0) return;
 
-			node_out.translation = { translation.x, translation.y, translation.z };
-			node_out.rotation = { rotation.x, rotation.y, rotation.z, rotation.w };
-			node_out.scale = { scale.x, scale.y, scale.z };
+	std::vector<int> remap;
+	size_t num_verts = Mid::OptimizeVertexFetch(&prim.faces[0].x, prim.faces.size() * 3, prim.points.size(), remap);
 
-			m_out.nodes.push_back(node_out);
-			if (prim.id_node_base >= 0)
+	bool identity = num_verts == remap.size();
+	for (size_t i = 0; i < remap.size() && identity; i++)
+	{
+		identity = remap[i] == (int)i;
+	}
+	if (identity) return;
+
+	usd2glb_remap(prim.points, remap, num_verts);
+	usd2glb_remap(prim.norms, remap, num_verts);
+	for (size_t i = 0; i < prim.uvs.size(); i++)
+	{
+		usd2glb_remap(prim.uvs[i], remap, num_verts);
+	}
+	usd2glb_remap(prim.colors, remap, num_verts);
+	usd2glb_remap(prim.joints, remap, num_verts);
+	usd2glb_remap(prim.weights, remap, num_verts);
+	for (size_t j = 0; j < prim.targets.size(); j++)
+	{
+		Mid::MorphTarget target;
+		usd2glb_remap_target(prim.targets[j], remap, target);
+		prim.targets[j] = std::move(target);
+	}
+
+	// The authored extent may cover dropped points.
+	if (num_verts < remap.size())
+	{
+		prim.lower = glm::vec3(FLT_MAX);
+		prim.upper = glm::vec3(-FLT_MAX);
+		for (size_t i = 0; i < num_verts; i++)
+		{
+			auto pos = prim.points[i];
+			prim.lower = glm::min(prim.lower, glm::vec3(pos[0], pos[1], pos[2]));
+			prim.upper = glm::max(prim.upper, glm::vec3(pos[0], pos[1], pos[2]));
+		}
+	}
+}
+
+// Bits of precision of a quantized attribute. 0 or more than the container holds selects
+// the container's full width.
+static int usd2glb_quantize_bits(int bits, int container_bits)
+{
+	if (bits <= 0 || bits > container_bits) return container_bits;
+	return bits < 2 ? 2 : bits;
+}
+
+static void usd2glb_quantize_stat(Mid::MeshInfo& info_out, const char* name, size_t bytes_float, size_t bytes_out, double max_error)
+{
+	Mid::QuantizeStat& stat = info_out.quantize_stats[name];
+	stat.bytes_float += bytes_float;
+	stat.bytes_out += bytes_out;
+	if (max_error > stat.max_error) stat.max_error = max_error;
+}
+
+// Packs morph target deltas times scale as normalized int16 VEC3s, elem_size bytes apart (6
+// for sparse values, 8 in a vertex attribute view). Returns false if a scaled component is
+// outside [-1, 1]; the target then stays float.
+static bool usd2glb_pack_deltas(const std::vector<glm::vec3>& deltas, float scale, size_t elem_size, std::vector<uint8_t>& out, double* max_error)
+{
+	for (size_t i = 0; i < deltas.size(); i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			if (fabs(deltas[i][c] * scale) > 1.0f) return false;
+		}
+	}
+
+	out.assign(deltas.size() * elem_size, 0);
+	for (size_t i = 0; i < deltas.size(); i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int q = Mid::QuantizeSnorm(deltas[i][c] * scale, 16, 16);
+			int16_t q16 = (int16_t)q;
+			memcpy(&out[i * elem_size + c * sizeof(int16_t)], &q16, sizeof(int16_t));
+			double error = fabs(Mid::DecodeSnorm(q, 16) / scale - deltas[i][c]);
+			if (error > *max_error) *max_error = error;
+		}
+	}
+	return true;
+}
+
+// Writes one morph target attribute from its sparse deltas, as a sparse accessor or a dense
+// one, whichever encodes smaller. With quant_scale > 0 the deltas times quant_scale are
+// written as normalized int16 if they fit. Returns the accessor.
+static int usd2glb_target_accessor(const std::vector<int>& indices, const std::vector<glm::vec3>& deltas, size_t num_verts, float quant_scale, bool bounds, const char* stat_name,
+	tinygltf::Model& m_out, Mid::BufferPlan& plan_out, Mid::MeshInfo& info_out)
+{
+	size_t offset = 0;
+	size_t length = 0;
+	size_t view_id = 0;
+	size_t acc_id = 0;
+
+	// A sparse accessor needs at least one element.
+	std::vector<int> sparse_indices = indices;
+	std::vector<glm::vec3> sparse_deltas = deltas;
+	if (sparse_indices.size() < 1)
+	{
+		sparse_indices.push_back(0);
+		sparse_deltas.push_back(glm::vec3(0.0f));
+	}
+	size_t count = sparse_indices.size();
+
+	bool quantized = quant_scale > 0.0f;
+	for (size_t i = 0; i < count && quantized; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			if (fabs(sparse_deltas[i][c] * quant_scale) > 1.0f) quantized = false;
+		}
+	}
+
+	int index_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+	size_t index_size = sizeof(uint32_t);
+	if (sparse_indices.back() <= 0xff)
+	{
+		index_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+		index_size = sizeof(uint8_t);
+	}
+	else if (sparse_indices.back() <= 0xffff)
+	{
+		index_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+		index_size = sizeof(uint16_t);
+	}
+
+	size_t sparse_bytes = (count * index_size + 3) / 4 * 4 + count * (quantized ? 6 : sizeof(glm::vec3));
+	size_t dense_bytes = num_verts * (quantized ? 8 : sizeof(glm::vec3));
+	bool is_sparse = sparse_bytes < dense_bytes;
+
+	// Vertices not listed have a zero delta.
+	glm::vec3 min_delta = sparse_deltas[0];
+	glm::vec3 max_delta = sparse_deltas[0];
+	if (indices.size() < num_verts)
+	{
+		min_delta = glm::vec3(0.0f);
+		max_delta = glm::vec3(0.0f);
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		min_delta = glm::min(min_delta, sparse_deltas[i]);
+		max_delta = glm::max(max_delta, sparse_deltas[i]);
+	}
+
+	std::vector<glm::vec3> dense_deltas;
+	if (!is_sparse)
+	{
+		dense_deltas.resize(num_verts, glm::vec3(0.0f));
+		for (size_t i = 0; i < count; i++) dense_deltas[sparse_indices[i]] = sparse_deltas[i];
+	}
+	const std::vector<glm::vec3>& values = is_sparse ? sparse_deltas : dense_deltas;
+
+	std::vector<uint8_t> values_q;
+	if (quantized)
+	{
+		double max_error = 0.0;
+		usd2glb_pack_deltas(values, quant_scale, is_sparse ? 6 : 8, values_q, &max_error);
+		usd2glb_quantize_stat(info_out, stat_name, sizeof(glm::vec3) * values.size(), values_q.size(), max_error);
+		for (int c = 0; c < 3; c++)
+		{
+			min_delta[c] = (float)Mid::QuantizeSnorm(min_delta[c] * quant_scale, 16, 16);
+			max_delta[c] = (float)Mid::QuantizeSnorm(max_delta[c] * quant_scale, 16, 16);
+		}
+	}
+
+	tinygltf::Accessor acc;
+	acc.byteOffset = 0;
+	acc.componentType = quantized ? TINYGLTF_COMPONENT_TYPE_SHORT : TINYGLTF_COMPONENT_TYPE_FLOAT;
+	acc.normalized = quantized;
+	acc.count = num_verts;
+	acc.type = TINYGLTF_TYPE_VEC3;
+	if (bounds)
+	{
+		acc.maxValues = { max_delta.x, max_delta.y, max_delta.z };
+		acc.minValues = { min_delta.x, min_delta.y, min_delta.z };
+	}
+
+	if (is_sparse)
+	{
+		acc.sparse.isSparse = true;
+		acc.sparse.count = (int)count;
+
+		length = count * index_size;
+		uint8_t* p_out = plan_out.Reserve(length, &offset);
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t idx = (uint32_t)sparse_indices[i];
+			if (index_size == sizeof(uint8_t)) p_out[i] = (uint8_t)idx;
+			else if (index_size == sizeof(uint16_t)) ((uint16_t*)p_out)[i] = (uint16_t)idx;
+			else ((uint32_t*)p_out)[i] = idx;
+		}
+
+		view_id = m_out.bufferViews.size();
+		{
+			tinygltf::BufferView view;
+			view.buffer = 0;
+			view.byteOffset = offset;
+			view.byteLength = length;
+			m_out.bufferViews.push_back(view);
+		}
+
+		acc.sparse.indices.bufferView = (int)view_id;
+		acc.sparse.indices.byteOffset = 0;
+		acc.sparse.indices.componentType = index_type;
+
+		if (quantized)
+		{
+			length = values_q.size();
+			offset = plan_out.Add(values_q.data(), length);
+		}
+		else
+		{
+			length = sizeof(glm::vec3) * count;
+			offset = plan_out.Add(values.data(), length);
+		}
+
+		view_id = m_out.bufferViews.size();
+		{
+			tinygltf::BufferView view;
+			view.buffer = 0;
+			view.byteOffset = offset;
+			view.byteLength = length;
+			m_out.bufferViews.push_back(view);
+		}
+
+		acc.sparse.values.bufferView = (int)view_id;
+		acc.sparse.values.byteOffset = 0;
+	}
+	else
+	{
+		if (quantized)
+		{
+			length = values_q.size();
+			offset = plan_out.Add(values_q.data(), length);
+		}
+		else
+		{
+			length = sizeof(glm::vec3) * num_verts;
+			offset = plan_out.Add(values.data(), length);
+		}
+
+		view_id = m_out.bufferViews.size();
+		{
+			tinygltf::BufferView view;
+			view.buffer = 0;
+			view.byteOffset = offset;
+			view.byteLength = length;
+			if (quantized) view.byteStride = 8;
+			m_out.bufferViews.push_back(view);
+		}
+
+		acc.bufferView = (int)view_id;
+	}
+
+	acc_id = m_out.accessors.size();
+	m_out.accessors.push_back(acc);
+	return (int)acc_id;
+}
+
+// Writes one primitive of mesh_out: vertex attributes, indices and morph targets. With
+// options.quantize, attributes and deltas use KHR_mesh_quantization types where they fit.
+static void usd2glb_primitive(const Mid::PrimitiveData& prim, int idx_material, const usd2glb_options& options, tinygltf::Model& m_out, tinygltf::Mesh& mesh_out, Mid::BufferPlan& plan_out, Mid::MeshInfo& info_out)
+{
+	mesh_out.primitives.emplace_back();
+	tinygltf::Primitive& prim_out = mesh_out.primitives.back();
+	prim_out.material = idx_material;
+	prim_out.mode = TINYGLTF_MODE_TRIANGLES;
+
+	std::vector<Mid::VertexAttrib> attribs;
+	size_t num_points = prim.points.size();
+
+	// Quantized VEC3s are padded to 4 components so every element stays 4 byte aligned.
+	std::vector<int16_t> points_q;
+	if (prim.dequant_scale > 0.0f)
+	{
+		int bits = usd2glb_quantize_bits(options.quantize_position_bits, 16);
+		std::vector<double> min_q(3, 0.0);
+		std::vector<double> max_q(3, 0.0);
+		double max_error = 0.0;
+		points_q.resize(num_points * 4, 0);
+		for (size_t i = 0; i < num_points; i++)
+		{
+			for (int c = 0; c < 3; c++)
 			{
-				m_out.nodes[prim.id_node_base].children.push_back(node_id);
+				float v = prim.points[i][c];
+				int q = Mid::QuantizeSnorm((v - prim.dequant_offset[c]) / prim.dequant_scale, bits, 16);
+				points_q[i * 4 + c] = (int16_t)q;
+				if (i == 0 || q < min_q[c]) min_q[c] = q;
+				if (i == 0 || q > max_q[c]) max_q[c] = q;
+				double error = fabs(Mid::DecodeSnorm(q, 16) * prim.dequant_scale + prim.dequant_offset[c] - v);
+				if (error > max_error) max_error = error;
 			}
-			else
+		}
+		attribs.push_back({ "POSITION", points_q.data(), num_points, 4 * sizeof(int16_t), TINYGLTF_TYPE_VEC3, TINYGLTF_COMPONENT_TYPE_SHORT, min_q, max_q, true });
+		usd2glb_quantize_stat(info_out, "POSITION", num_points * sizeof(glm::vec3), num_points * 4 * sizeof(int16_t), max_error);
+	}
+	else
+	{
+		attribs.push_back({ "POSITION", prim.points.data(), num_points, sizeof(glm::vec3), TINYGLTF_TYPE_VEC3, TINYGLTF_COMPONENT_TYPE_FLOAT,
+			{ prim.lower.x, prim.lower.y, prim.lower.z }, { prim.upper.x, prim.upper.y, prim.upper.z } });
+	}
+
+	std::vector<int8_t> norms_q;
+	if (prim.norms.size() > 0 && options.quantize)
+	{
+		int bits = usd2glb_quantize_bits(options.quantize_normal_bits, 8);
+		double max_error = 0.0;
+		norms_q.resize(prim.norms.size() * 4, 0);
+		for (size_t i = 0; i < prim.norms.size(); i++)
+		{
+			glm::vec3 norm = prim.norms[i];
+			float len = glm::length(norm);
+			if (len > 0.0f) norm /= len;
+			for (int c = 0; c < 3; c++)
 			{
-				rotation = axis_rot * rotation;
-				node_out.rotation = { rotation.x, rotation.y, rotation.z, rotation.w };
-				scene_out.nodes.push_back(node_id);
+				int q = Mid::QuantizeSnorm(norm[c], bits, 8);
+				norms_q[i * 4 + c] = (int8_t)q;
+				double error = fabs(Mid::DecodeSnorm(q, 8) - norm[c]);
+				if (error > max_error) max_error = error;
 			}
-			prim.id_node_base = node_id;
 		}
-		else if (prim.prim->data().type_id() == tinyusdz::value::TYPE_ID_SKEL_ROOT)
+		attribs.push_back({ "NORMAL", norms_q.data(), prim.norms.size(), 4 * sizeof(int8_t), TINYGLTF_TYPE_VEC3, TINYGLTF_COMPONENT_TYPE_BYTE, {}, {}, true });
+		usd2glb_quantize_stat(info_out, "NORMAL", prim.norms.size() * sizeof(glm::vec3), norms_q.size(), max_error);
+	}
+	else if (prim.norms.size() > 0)
+	{
+		attribs.push_back({ "NORMAL", prim.norms.data(), prim.norms.size(), sizeof(glm::vec3), TINYGLTF_TYPE_VEC3, TINYGLTF_COMPONENT_TYPE_FLOAT });
+	}
+
+	// UV sets outside [0, 1] would need KHR_texture_transform to be normalized, they stay float.
+	std::vector<std::vector<uint16_t>> uvs_q(prim.uvs.size());
+	for (size_t i = 0; i < prim.uvs.size(); i++)
+	{
+		const std::vector<glm::vec2>& uvs = prim.uvs[i];
+		std::string name = "TEXCOORD_" + std::to_string(i);
+
+		bool in_range = options.quantize != 0;
+		for (size_t j = 0; j < uvs.size() && in_range; j++)
 		{
-			auto* node_in = prim.prim->data().as<tinyusdz::SkelRoot>();
-			int node_id = (int)m_out.nodes.size();
+			in_range = uvs[j].x >= 0.0f && uvs[j].x <= 1.0f && uvs[j].y >= 0.0f && uvs[j].y <= 1.0f;
+		}
 
+		if (in_range)
+		{
+			int bits = usd2glb_quantize_bits(options.quantize_uv_bits, 16);
+			double max_error = 0.0;
+			uvs_q[i].resize(uvs.size() * 2);
+			for (size_t j = 0; j < uvs.size(); j++)
 			{
-				auto iter = node_in->props.find("skel:skeleton");
-				if (iter != node_in->props.end())
+				for (int c = 0; c < 2; c++)
 				{
-					prim.skel_path = iter->second.get_relationship().targetPath.full_path_name();					
+					int q = Mid::QuantizeUnorm(uvs[j][c], bits, 16);
+					uvs_q[i][j * 2 + c] = (uint16_t)q;
+					double error = fabs(Mid::DecodeUnorm(q, 16) - uvs[j][c]);
+					if (error > max_error) max_error = error;
 				}
 			}
+			attribs.push_back({ name, uvs_q[i].data(), uvs.size(), 2 * sizeof(uint16_t), TINYGLTF_TYPE_VEC2, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, {}, {}, true });
+			usd2glb_quantize_stat(info_out, "TEXCOORD", uvs.size() * sizeof(glm::vec2), uvs_q[i].size() * sizeof(uint16_t), max_error);
+		}
+		else
+		{
+			attribs.push_back({ name, uvs.data(), uvs.size(), sizeof(glm::vec2), TINYGLTF_TYPE_VEC2, TINYGLTF_COMPONENT_TYPE_FLOAT });
+		}
+	}
+	if (prim.colors.size() > 0)
+	{
+		attribs.push_back({ "COLOR_0", prim.colors.data(), prim.colors.size(), sizeof(glm::vec3), TINYGLTF_TYPE_VEC3, TINYGLTF_COMPONENT_TYPE_FLOAT });
+	}
+	if (prim.joints.size() > 0)
+	{
+		attribs.push_back({ "JOINTS_0", prim.joints.data(), prim.joints.size(), sizeof(glm::u8vec4), TINYGLTF_TYPE_VEC4, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE });
+		attribs.push_back({ "WEIGHTS_0", prim.weights.data(), prim.weights.size(), sizeof(glm::vec4), TINYGLTF_TYPE_VEC4, TINYGLTF_COMPONENT_TYPE_FLOAT });
+	}
+	usd2glb_attributes(attribs, options.interleave != 0, m_out, prim_out, plan_out);
 
-			tinygltf::Node node_out;
-			node_out.name = node_in->name;
-			
-			for (size_t i = 0; i < node_in->xformOps.size(); i++)
-			{
-				auto& op = node_in->xformOps[i];				
-				if (op.op_type == tinyusdz::XformOp::OpType::Transform)
-				{
-					auto* matrix = op.get_scalar().value().as<tinyusdz::value::matrix4d>();
-
-					glm::mat4 mat = mat_convert(*matrix);
-					glm::vec3 scale;
-					glm::quat rotation;
-					glm::vec3 translation;
-
-					glm::vec3 skew;
-					glm::vec4 persp;
-					glm::decompose(mat, scale, rotation, translation, skew, persp);
+	// EXT_meshopt_compression encodes 16 and 32-bit indices only.
+	usd2glb_indices(prim, options.meshopt == 0, m_out, prim_out, plan_out);
 
-					rotation = axis_rot * rotation;
-					
-					node_out.translation = { translation.x, translation.y, translation.z };
-					node_out.rotation = { rotation.x, rotation.y, rotation.z, rotation.w };
-					node_out.scale = { scale.x, scale.y, scale.z };
+	if (prim.targets.size() > 0)
+	{
+		// Target deltas are in the same normalized space as quantized positions.
+		float pos_scale = prim.dequant_scale > 0.0f ? 1.0f / prim.dequant_scale : 0.0f;
+		float norm_scale = options.quantize ? 1.0f : 0.0f;
 
-					m_out.nodes.push_back(node_out);
-					scene_out.nodes.push_back(node_id);
+		prim_out.targets.resize(prim.targets.size());
+		for (size_t j = 0; j < prim.targets.size(); j++)
+		{
+			const Mid::MorphTarget& target = prim.targets[j];
+			prim_out.targets[j]["POSITION"] = usd2glb_target_accessor(target.indices, target.offsets, num_points, pos_scale, true, "morph POSITION", m_out, plan_out, info_out);
+			if (target.norm_offsets.size() > 0)
+			{
+				prim_out.targets[j]["NORMAL"] = usd2glb_target_accessor(target.indices, target.norm_offsets, num_points, norm_scale, false, "morph NORMAL", m_out, plan_out, info_out);
+			}
+		}
+	}
+}
 
-					prim.id_node_base = node_id;
+// Encodes the vertex and index buffer views of a converted mesh with EXT_meshopt_compression,
+// in parallel across views, and lays plan_out out again with the encoded data. With
+// meshopt_fallback the decoded data stays in front of it; otherwise the views move to buffer
+// 1, a fallback buffer without data, at offsets usd2glb_merge_mesh() rebases.
+static void usd2glb_meshopt(const usd2glb_options& options, tinygltf::Model& m_out, Mid::BufferPlan& plan_out, Mid::MeshInfo& info_out)
+{
+	// Region of every buffer view, matched by offset and size, as an empty region shares its
+	// offset with the next one.
+	std::vector<int> view_regions_all(m_out.bufferViews.size(), -1);
+	{
+		std::unordered_multimap<size_t, size_t> regions_at;
+		for (size_t r = 0; r < plan_out.regions.size(); r++)
+		{
+			regions_at.emplace(plan_out.regions[r].offset, r);
+		}
+		for (size_t i = 0; i < m_out.bufferViews.size(); i++)
+		{
+			const tinygltf::BufferView& view = m_out.bufferViews[i];
+			auto range = regions_at.equal_range(view.byteOffset);
+			for (auto iter = range.first; iter != range.second; iter++)
+			{
+				if (plan_out.regions[iter->second].size == view.byteLength)
+				{
+					view_regions_all[i] = (int)iter->second;
 					break;
 				}
 			}
 		}
-		else if (prim.prim->data().type_id() == tinyusdz::value::TYPE_ID_GEOM_MESH)
+	}
+
+	std::vector<size_t> elem_sizes(m_out.bufferViews.size(), 0);
+	for (size_t i = 0; i < m_out.accessors.size(); i++)
+	{
+		const tinygltf::Accessor& acc = m_out.accessors[i];
+		if (acc.bufferView < 0) continue;
+		elem_sizes[acc.bufferView] = tinygltf::GetComponentSizeInBytes(acc.componentType) * tinygltf::GetNumComponentsInType(acc.type);
+	}
+
+	std::vector<Mid::MeshoptView> views;
+	std::vector<size_t> view_regions;
+	for (size_t i = 0; i < m_out.bufferViews.size(); i++)
+	{
+		const tinygltf::BufferView& view = m_out.bufferViews[i];
+		if (view_regions_all[i] < 0 || view.byteLength == 0) continue;
+
+		Mid::MeshoptView meshopt_view;
+		meshopt_view.view = (int)i;
+		if (view.target == TINYGLTF_TARGET_ARRAY_BUFFER)
 		{
-			auto* mesh_in = prim.prim->data().as<tinyusdz::GeomMesh>();
+			meshopt_view.stride = view.byteStride > 0 ? view.byteStride : elem_sizes[i];
+			if (meshopt_view.stride == 0 || meshopt_view.stride % 4 != 0 || meshopt_view.stride > 256) continue;
+		}
+		else if (view.target == TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER)
+		{
+			meshopt_view.triangles = true;
+			meshopt_view.stride = elem_sizes[i];
+			if (meshopt_view.stride != 2 && meshopt_view.stride != 4) continue;
+			if (view.byteLength / meshopt_view.stride % 3 != 0) continue;
+		}
+		else
+		{
+			continue;
+		}
+		meshopt_view.count = view.byteLength / meshopt_view.stride;
+		views.push_back(meshopt_view);
+		view_regions.push_back(view_regions_all[i]);
+	}
+	if (views.size() == 0) return;
 
-			bool leftHand = false;
-			if (mesh_in->orientation.get_value() == tinyusdz::Orientation::LeftHanded)
+	std::vector<std::vector<uint8_t>> encoded(views.size());
+	std::vector<double> seconds(views.size(), 0.0);
+	Mid::ThreadPool::Shared().ParallelFor(views.size(), [&](size_t i)
+		{
+			auto t0 = std::chrono::steady_clock::now();
+			const Mid::MeshoptView& view = views[i];
+			const uint8_t* data = plan_out.regions[view_regions[i]].data.get();
+			if (view.triangles)
 			{
-				leftHand = true;				
-			}						
-
-			if (mesh_in->materialBinding.has_value())
+				Mid::Meshopt::EncodeIndexBuffer(data, view.count, view.stride, encoded[i]);
+			}
+			else
 			{
-				std::string material_path = mesh_in->materialBinding.value().targetPath.full_path_name();
-				prim.idx_material = material_map[material_path];
+				Mid::Meshopt::EncodeVertexBuffer(data, view.count, view.stride, encoded[i]);
 			}
+			seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		}, options.num_threads);
 
-			int node_id = (int)m_out.nodes.size();
-			int mesh_id = (int)m_out.meshes.size();			
-
-			tinygltf::Node node_out;
-			node_out.name = mesh_in->name;
-			node_out.mesh = mesh_id;
-			m_out.nodes.push_back(node_out);			
+	std::vector<int> encoded_of(plan_out.regions.size(), -1);
+	for (size_t i = 0; i < views.size(); i++)
+	{
+		encoded_of[view_regions[i]] = (int)i;
+	}
 
-			if (prim.id_node_base >= 0)
+	// New offset of every region kept in the BIN buffer, SIZE_MAX for the others.
+	std::vector<size_t> offsets(plan_out.regions.size(), SIZE_MAX);
+	Mid::BufferPlan plan;
+	for (size_t r = 0; r < plan_out.regions.size(); r++)
+	{
+		Mid::BufferPlan::Region& region = plan_out.regions[r];
+		int e = encoded_of[r];
+		if (e < 0 || options.meshopt_fallback)
+		{
+			offsets[r] = plan.Add(std::move(region.data), region.size);
+		}
+		if (e >= 0)
+		{
+			Mid::MeshoptView& view = views[e];
+			view.length = encoded[e].size();
+			view.offset = plan.Add(encoded[e].data(), view.length);
+			if (!options.meshopt_fallback)
 			{
-				m_out.nodes[prim.id_node_base].children.push_back(node_id);
-			}
-			else
-			{				
-				node_out.rotation = { axis_rot.x, axis_rot.y, axis_rot.z, axis_rot.w };
-				scene_out.nodes.push_back(node_id);
+				view.fallback_offset = (info_out.fallback_size + 3) / 4 * 4;
+				info_out.fallback_size = view.fallback_offset + region.size;
 			}
-			prim.id_node_base = node_id;
+			info_out.meshopt_bytes_in += region.size;
+			info_out.meshopt_bytes_out += view.length;
+			info_out.meshopt_seconds += seconds[e];
+			encoded[e].clear();
+			encoded[e].shrink_to_fit();
+		}
+	}
+	plan_out = std::move(plan);
+
+	for (size_t i = 0; i < m_out.bufferViews.size(); i++)
+	{
+		int r = view_regions_all[i];
+		if (r >= 0 && offsets[r] != SIZE_MAX) m_out.bufferViews[i].byteOffset = offsets[r];
+	}
+	if (!options.meshopt_fallback)
+	{
+		for (size_t i = 0; i < views.size(); i++)
+		{
+			tinygltf::BufferView& view = m_out.bufferViews[views[i].view];
+			view.buffer = 1;
+			view.byteOffset = views[i].fallback_offset;
+		}
+	}
+	info_out.meshopt_views = std::move(views);
+}
 
-			tinygltf::Mesh mesh_out;
-			mesh_out.name = node_out.name;
-			mesh_out.primitives.resize(1);
+// Reads an array attribute of float tuples (float2, texCoord2f, normal3f, color3f...) as
+// plain floats, num_comps per element.
+template<typename T>
+static bool usd2glb_read_floats(const tinyusdz::Attribute& attr, Mid::Primvar& primvar)
+{
+	auto value = attr.get_value<std::vector<T>>();
+	if (!value.has_value()) return false;
+	const std::vector<T>& elems = value.value();
+	primvar.num_comps = (int)(sizeof(T) / sizeof(float));
+	primvar.values.resize(elems.size() * primvar.num_comps);
+	memcpy(primvar.values.data(), elems.data(), primvar.values.size() * sizeof(float));
+	return true;
+}
 
-			auto& prim_out = mesh_out.primitives[0];
+// Reads primvars:<name> and its :indices.
+static bool usd2glb_read_primvar(const tinyusdz::GeomMesh* mesh_in, const std::string& name, Mid::Primvar& primvar)
+{
+	auto iter = mesh_in->props.find("primvars:" + name);
+	if (iter == mesh_in->props.end() || !iter->second.is_attribute()) return false;
+	const tinyusdz::Attribute& attr = iter->second.get_attribute();
 
-			std::vector<tinyusdz::value::point3f> points_in;
-			std::vector<tinyusdz::value::normal3f> norms_in;
+	bool ok = false;
+	if (primvar.target == Mid::Primvar::TEXCOORD)
+	{
+		ok = usd2glb_read_floats<tinyusdz::value::float2>(attr, primvar) || usd2glb_read_floats<tinyusdz::value::texcoord2f>(attr, primvar);
+	}
+	else if (primvar.target == Mid::Primvar::NORMAL)
+	{
+		ok = usd2glb_read_floats<tinyusdz::value::normal3f>(attr, primvar) || usd2glb_read_floats<tinyusdz::value::float3>(attr, primvar);
+	}
+	else
+	{
+		ok = usd2glb_read_floats<tinyusdz::value::color3f>(attr, primvar) || usd2glb_read_floats<tinyusdz::value::float3>(attr, primvar);
+	}
+	if (!ok) return false;
 
-			std::vector<std::vector<tinyusdz::value::vector3f>> offsets_in;
-			std::vector<std::vector<tinyusdz::value::vector3f>> norm_offsets_in;
-			std::vector<bool> target_sparse;
-			std::vector<std::vector<bool>> non_zeros_in;
+	if (attr.metas().interpolation.has_value())
+	{
+		primvar.interpolation = attr.metas().interpolation.value();
+	}
 
-			std::vector<glm::u8vec4> conv_ji_in;
-			std::vector<glm::vec4> conv_jw_in;
+	auto iter_indices = mesh_in->props.find("primvars:" + name + ":indices");
+	if (iter_indices != mesh_in->props.end() && iter_indices->second.is_attribute())
+	{
+		auto indices = iter_indices->second.get_attribute().get_value<std::vector<int>>();
+		if (indices.has_value()) primvar.indices = indices.value();
+	}
+	return true;
+}
 
-			std::vector<int> faceVertexIndices;
-			std::vector<int> faceVertexCounts;
-			
-			std::vector<glm::ivec3> faces;
+// Converts the geometry of one mesh into m_out, a scratch model that holds only this mesh
+// and the accessors and buffer views it needs, with their data laid out in plan_out.
+// usd2glb_merge_mesh() moves both into the output afterwards.
+static void usd2glb_mesh(const Mid::MeshJob& job, const usd2glb_options& options, tinygltf::Model& m_out, Mid::BufferPlan& plan_out, Mid::MeshInfo& info_out)
+{
+	auto* mesh_in = job.mesh_in;
 
-			bool uv_indp_indices = false;
-			std::vector<tinyusdz::value::float2> uv_in;
-			std::vector<int> uv_indices_in;
+	bool leftHand = false;
+	if (mesh_in->orientation.get_value() == tinyusdz::Orientation::LeftHanded)
+	{
+		leftHand = true;
+	}
 
-			int idx_material = prim.idx_material;
-			if (idx_material == -1)
+	std::vector<tinyusdz::value::point3f> points_in;
+
+	std::vector<Mid::MorphTarget> targets_in;
+
+	std::vector<glm::u8vec4> conv_ji_in;
+	std::vector<glm::vec4> conv_jw_in;
+
+	std::vector<int> faceVertexIndices;
+	std::vector<int> faceVertexCounts;
+
+	Mid::PrimitiveData prim;
+
+	mesh_in->points.get_value().value().get_scalar(&points_in);
+
+	tinyusdz::Extent extent;
+	mesh_in->extent.get_value().value().get_scalar(&extent);
+
+	mesh_in->faceVertexIndices.get_value().value().get_scalar(&faceVertexIndices);
+	mesh_in->faceVertexCounts.get_value().value().get_scalar(&faceVertexCounts);
+
+	// Normals, every uv set (the material's first, as TEXCOORD_0) and displayColor.
+	std::vector<Mid::Primvar> primvars;
+	{
+		Mid::Primvar normals;
+		normals.target = Mid::Primvar::NORMAL;
+		if (usd2glb_read_primvar(mesh_in, "normals", normals))
+		{
+			primvars.push_back(std::move(normals));
+		}
+		else if (mesh_in->normals.get_value().has_value())
+		{
+			std::vector<tinyusdz::value::normal3f> norms_in;
+			mesh_in->normals.get_value().value().get_scalar(&norms_in);
+			normals.num_comps = 3;
+			normals.values.resize(norms_in.size() * 3);
+			memcpy(normals.values.data(), norms_in.data(), normals.values.size() * sizeof(float));
+			if (mesh_in->normals.metas().interpolation.has_value())
 			{
-				idx_material = (int)material_lst.size();
-				Mid::Material material_mid;
-				auto iter = mesh_in->props.find("primvars:displayColor");
-				if (iter != mesh_in->props.end())
-				{
-					auto col = iter->second.get_attribute().get_value<std::vector<tinyusdz::value::float3>>().value()[0];
-					material_mid.diffuse_color = { col[0], col[1], col[2] };
-				}
-				material_lst.push_back(material_mid);
-				prim.idx_material = idx_material;
+				normals.interpolation = mesh_in->normals.metas().interpolation.value();
 			}
-			else
+			primvars.push_back(std::move(normals));
+		}
+
+		std::vector<std::string> uvsets;
+		uvsets.push_back(job.uvset);
+		for (auto& prop : mesh_in->props)
+		{
+			const std::string& name = prop.first;
+			if (name.compare(0, 9, "primvars:") != 0) continue;
+			std::string var_name = name.substr(9);
+			if (var_name == job.uvset || var_name.find(':') != std::string::npos) continue;
+			if (var_name == "normals" || var_name == "displayColor" || var_name == "displayOpacity") continue;
+			uvsets.push_back(var_name);
+		}
+		for (size_t i = 0; i < uvsets.size(); i++)
+		{
+			Mid::Primvar uv;
+			uv.target = Mid::Primvar::TEXCOORD;
+			if (usd2glb_read_primvar(mesh_in, uvsets[i], uv) && uv.num_comps == 2)
 			{
-				Mid::Material material_mid = material_lst[idx_material];
-				auto iter = mesh_in->props.find("primvars:"+ material_mid.diffuse_varname);
-				if (iter != mesh_in->props.end())
-				{
-					auto col = iter->second.get_attribute().get_value<std::vector<tinyusdz::value::float3>>().value()[0];
-					material_mid.diffuse_color = { col[0], col[1], col[2] };
-					idx_material = (int)material_lst.size();
-					material_lst.push_back(material_mid);
-					prim.idx_material = idx_material;
-				}
+				primvars.push_back(std::move(uv));
 			}
+		}
 
-			Mid::Material& material_mid = material_lst[idx_material];
-			material_mid.double_sided = mesh_in->doubleSided.get_value();
+		Mid::Primvar color;
+		color.target = Mid::Primvar::COLOR;
+		if (usd2glb_read_primvar(mesh_in, "displayColor", color) && color.interpolation != tinyusdz::Interpolation::Constant)
+		{
+			primvars.push_back(std::move(color));
+		}
+	}
 
-			prim_out.material = idx_material;
-			
-			mesh_in->points.get_value().value().get_scalar(&points_in);
+	size_t num_corners = faceVertexIndices.size();
+	size_t num_faces = faceVertexCounts.size();
+	bool has_normals = false;
+	bool per_corner = false;
+	for (size_t i = 0; i < primvars.size(); )
+	{
+		if (!primvars[i].Valid(points_in.size(), num_corners, num_faces))
+		{
+			primvars.erase(primvars.begin() + i);
+			continue;
+		}
+		if (primvars[i].target == Mid::Primvar::NORMAL) has_normals = true;
+		if (primvars[i].PerCorner()) per_corner = true;
+		i++;
+	}
 
-			tinyusdz::Extent extent;
-			mesh_in->extent.get_value().value().get_scalar(&extent);
+	{
+		auto iter_ji = mesh_in->props.find("primvars:skel:jointIndices");
+		auto iter_jw = mesh_in->props.find("primvars:skel:jointWeights");
+		if (iter_ji != mesh_in->props.end() && iter_jw != mesh_in->props.end())
+		{
+			unsigned elem_size = iter_ji->second.get_attribute().metas().elementSize.value();					
+			bool constant_joints = iter_ji->second.get_attribute().metas().interpolation.value() == tinyusdz::Interpolation::Constant;
 
-			if (mesh_in->normals.get_value().has_value())
-			{
-				mesh_in->normals.get_value().value().get_scalar(&norms_in);
-			}
+			auto ji = iter_ji->second.get_attribute().get_value<std::vector<int>>().value();
+			auto jw = iter_jw->second.get_attribute().get_value<std::vector<float>>().value();
+			size_t count = ji.size() / elem_size;
 
-			mesh_in->faceVertexIndices.get_value().value().get_scalar(&faceVertexIndices);
-			mesh_in->faceVertexCounts.get_value().value().get_scalar(&faceVertexCounts);
+			if (constant_joints)
+			{						
+				count = points_in.size();
+				conv_ji_in.resize(count, { 0,0,0,0 });
+				conv_jw_in.resize(count, { 0.0f, 0.0f, 0.0f, 0.0f });
 
-			{			
-				std::string var_name_uvset = std::string("primvars:") + material_mid.uvset;
-				auto iter = mesh_in->props.find(var_name_uvset);
-				if (iter != mesh_in->props.end())
+				for (size_t i = 0; i < count; i++)
 				{
-					uv_in = iter->second.get_attribute().get_value<std::vector<tinyusdz::value::float2>>().value();
-					auto interpo = iter->second.get_attribute().metas().interpolation.value();
-					uv_indp_indices = interpo == tinyusdz::Interpolation::FaceVarying;
-					std::string var_name_uv_indices = std::string("primvars:") + material_mid.uvset + ":indices";
-					auto iter2 = mesh_in->props.find(var_name_uv_indices);
-					if (iter2 != mesh_in->props.end())
-					{
-						uv_indices_in = iter2->second.get_attribute().get_value<std::vector<int>>().value();
+					unsigned elems = 4;
+					if (elem_size < elems) elems = elem_size;
+					for (unsigned j = 0; j < elems; j++)
+					{								
+						conv_ji_in[i][j] = (uint8_t)ji[j];
+						conv_jw_in[i][j] = jw[j];
 					}
 				}
 			}
+			else
+			{					
 
-			{
-				auto iter_ji = mesh_in->props.find("primvars:skel:jointIndices");
-				auto iter_jw = mesh_in->props.find("primvars:skel:jointWeights");
-				if (iter_ji != mesh_in->props.end() && iter_jw != mesh_in->props.end())
+				conv_ji_in.resize(count, { 0,0,0,0 });
+				conv_jw_in.resize(count, { 0.0f, 0.0f, 0.0f, 0.0f });
+
+				for (size_t i = 0; i < count; i++)
 				{
-					if (mesh_in->skeleton.has_value())
+					unsigned elems = 4;
+					if (elem_size < elems) elems = elem_size;
+					for (unsigned j = 0; j < elems; j++)
 					{
-						prim.skel_path = mesh_in->skeleton.value().targetPath.full_path_name();
-					}
-					node_skin_map[node_id] = prim.skel_path;
-
-					unsigned elem_size = iter_ji->second.get_attribute().metas().elementSize.value();					
-					bool constant_joints = iter_ji->second.get_attribute().metas().interpolation.value() == tinyusdz::Interpolation::Constant;
-
-					auto ji = iter_ji->second.get_attribute().get_value<std::vector<int>>().value();
-					auto jw = iter_jw->second.get_attribute().get_value<std::vector<float>>().value();
-					size_t count = ji.size() / elem_size;
-
-					if (constant_joints)
-					{						
-						count = points_in.size();
-						conv_ji_in.resize(count, { 0,0,0,0 });
-						conv_jw_in.resize(count, { 0.0f, 0.0f, 0.0f, 0.0f });
-
-						for (size_t i = 0; i < count; i++)
-						{
-							unsigned elems = 4;
-							if (elem_size < elems) elems = elem_size;
-							for (unsigned j = 0; j < elems; j++)
-							{								
-								conv_ji_in[i][j] = (uint8_t)ji[j];
-								conv_jw_in[i][j] = jw[j];
-							}
-						}
-					}
-					else
-					{					
-
-						conv_ji_in.resize(count, { 0,0,0,0 });
-						conv_jw_in.resize(count, { 0.0f, 0.0f, 0.0f, 0.0f });
-
-						for (size_t i = 0; i < count; i++)
-						{
-							unsigned elems = 4;
-							if (elem_size < elems) elems = elem_size;
-							for (unsigned j = 0; j < elems; j++)
-							{
-								size_t idx = elem_size * i + j;
-								conv_ji_in[i][j] = (uint8_t)ji[idx];
-								conv_jw_in[i][j] = jw[idx];
-							}
-						}
+						size_t idx = elem_size * i + j;
+						conv_ji_in[i][j] = (uint8_t)ji[idx];
+						conv_jw_in[i][j] = jw[idx];
 					}
-
 				}
-
 			}
 
-			{
-				auto iter = mesh_in->props.find("skel:blendShapeTargets");
-				if (iter != mesh_in->props.end())
-				{					
-					auto paths = iter->second.get_relationship().targetPathVector;					
-					auto iter2 = mesh_in->props.find("skel:blendShapes");
-					auto names = iter2->second.get_attribute().get_value<std::vector<tinyusdz::Token>>().value();
-
-					size_t num_morphs = paths.size();
-					offsets_in.resize(num_morphs);
-					norm_offsets_in.resize(num_morphs);
-					target_sparse.resize(num_morphs, false);
-					non_zeros_in.resize(num_morphs);
+		}
 
-					target_counts[node_id] = (int)num_morphs;
+	}
 
-					for (size_t i = 0; i < num_morphs; i++)
-					{						
-						std::string name = names[i].str();
-						morph_map[name].push_back({ node_id, (int)i });
+	{
+		size_t num_morphs = job.blend_shapes.size();
+		if (num_morphs > 0)
+		{
+			targets_in.resize(num_morphs);
+			// Pruning is opt-in: it renumbers the targets, which consumers may address by
+			// blend shape index.
+			bool prune = options.morph_epsilon != 0.0f;
+			float epsilon = glm::max(options.morph_epsilon, 0.0f);
 
-						const tinyusdz::Prim* primbs = stage.GetPrimAtPath(paths[i]).value();
-						auto* bs = primbs->data().as<tinyusdz::BlendShape>();
+			for (size_t i = 0; i < num_morphs; i++)
+			{
+				auto* bs = job.blend_shapes[i];
+				Mid::MorphTarget& target = targets_in[i];
 
-						std::vector<tinyusdz::value::vector3f> offsets = bs->offsets.get_value().value();
-						offsets_in[i].resize(points_in.size());
+				std::vector<tinyusdz::value::vector3f> offsets = bs->offsets.get_value().value();
 
-						std::vector<tinyusdz::value::vector3f> normOffsets;												
-						if (norms_in.size() > 0)
-						{
-							normOffsets = bs->normalOffsets.get_value().value();
-							norm_offsets_in[i].resize(norms_in.size());
-						}
+				std::vector<tinyusdz::value::vector3f> normOffsets;												
+				if (has_normals)
+				{
+					normOffsets = bs->normalOffsets.get_value().value();
+				}
 
-						non_zeros_in[i].resize(points_in.size(), false);
-						
-						if (bs->pointIndices.get_value().has_value())
-						{
-							target_sparse[i] = true;
-							auto pointIndices = bs->pointIndices.get_value().value();
-							size_t num_points = pointIndices.size();
-							for (size_t j = 0; j < num_points; j++)
-							{
-								int idx = pointIndices[j];
-								offsets_in[i][idx] = offsets[j];
-								if (normOffsets.size() > 0)
-								{
-									norm_offsets_in[i][idx] = normOffsets[j];
-								}
-								non_zeros_in[i][idx] = true;
-							}
-						}
-						else
-						{
-							target_sparse[i] = false;
-							for (size_t j = 0; j < points_in.size(); j++)
-							{
-								offsets_in[i][j] = offsets[j];
-								if (normOffsets.size() > 0)
-								{
-									norm_offsets_in[i][j] = normOffsets[j];
-								}
-								non_zeros_in[i][j] = true;
-							}
-						}
-					}
+				// Points moved by the shape: pointIndices, or every point.
+				std::vector<int> pointIndices;
+				if (bs->pointIndices.get_value().has_value())
+				{
+					pointIndices = bs->pointIndices.get_value().value();
+				}
+				else
+				{
+					pointIndices.resize(offsets.size() < points_in.size() ? offsets.size() : points_in.size());
+					for (size_t j = 0; j < pointIndices.size(); j++) pointIndices[j] = (int)j;
+				}
 
+				size_t num_points = pointIndices.size() < offsets.size() ? pointIndices.size() : offsets.size();
+				target.indices.reserve(num_points);
+				target.offsets.reserve(num_points);
+				if (has_normals) target.norm_offsets.reserve(num_points);
+				for (size_t j = 0; j < num_points; j++)
+				{
+					int idx = pointIndices[j];
+					if (idx < 0 || (size_t)idx >= points_in.size()) continue;
+					glm::vec3 offset = glm::vec3(offsets[j][0], offsets[j][1], offsets[j][2]);
+					glm::vec3 norm_offset = glm::vec3(0.0f);
+					if (has_normals && j < normOffsets.size()) norm_offset = glm::vec3(normOffsets[j][0], normOffsets[j][1], normOffsets[j][2]);
+
+					// Points the shape doesn't move are left out, so mostly static shapes
+					// end up sparse and shapes that move nothing are dropped below.
+					glm::vec3 amount = glm::max(glm::abs(offset), glm::abs(norm_offset));
+					if (prune && glm::max(amount.x, glm::max(amount.y, amount.z)) <= epsilon) continue;
+
+					target.indices.push_back(idx);
+					target.offsets.push_back(offset);
+					if (has_normals) target.norm_offsets.push_back(norm_offset);
 				}
+				usd2glb_sort_target(target);
 			}
 
-			if (uv_indp_indices)
-			{
-				struct PointIn
-				{
-					int ind_pnt;
-					tinyusdz::value::float2 uv;
-				};
+		}
+	}
 
-				std::vector<tinyusdz::value::point3f> points_out;
-				std::vector<tinyusdz::value::normal3f> norms_out;
+	// Output vertices and the point, face-vertex and face each one takes its values from.
+	std::vector<int> src_point;
+	std::vector<int> src_corner;
+	std::vector<int> src_face;
 
-				std::vector<std::vector<tinyusdz::value::vector3f>> offsets_out;
-				std::vector<std::vector<tinyusdz::value::vector3f>> norm_offsets_out;
-				std::vector<std::vector<bool>> non_zeros_out;
+	if (per_corner)
+	{
+		// Face-vertices that share a point and every per-corner primvar value become one
+		// vertex, all primvars welded in a single pass.
+		size_t key_size = sizeof(int);
+		for (size_t i = 0; i < primvars.size(); i++)
+		{
+			if (primvars[i].PerCorner()) key_size += primvars[i].num_comps * sizeof(float);
+		}
 
-				std::vector<glm::u8vec4> conv_ji_out;
-				std::vector<glm::vec4> conv_jw_out;
-				std::vector<tinyusdz::value::float2> uv_out;
-				std::unordered_map<uint64_t, int> points_map;
-				std::vector<int> faceVertexIndices_out(faceVertexIndices.size());
+		Mid::VertexWelder welder(key_size, num_corners);
+		std::vector<uint8_t> key(key_size);
+		std::vector<int> faceVertexIndices_out(num_corners);
 
-				size_t num_targets = offsets_in.size();
-				if (num_targets > 0)
+		size_t corner = 0;
+		for (size_t face = 0; face < num_faces; face++)
+		{
+			for (int k = 0; k < faceVertexCounts[face] && corner < num_corners; k++, corner++)
+			{
+				int point = faceVertexIndices[corner];
+				memcpy(key.data(), &point, sizeof(int));
+				size_t key_offset = sizeof(int);
+				for (size_t i = 0; i < primvars.size(); i++)
 				{
-					offsets_out.resize(num_targets);
-					norm_offsets_out.resize(num_targets);
-					non_zeros_out.resize(num_targets);
+					if (!primvars[i].PerCorner()) continue;
+					size_t size = primvars[i].num_comps * sizeof(float);
+					memcpy(key.data() + key_offset, primvars[i].Value(corner, point, face), size);
+					key_offset += size;
 				}
-				
 
-				for (size_t i = 0; i < faceVertexIndices.size(); i++)
+				int idx_out = welder.Insert(key.data());
+				faceVertexIndices_out[corner] = idx_out;
+				if (idx_out == (int)src_point.size())
 				{
-					PointIn pnt;
-					pnt.ind_pnt = faceVertexIndices[i];
-					if (uv_indices_in.size() > 0)
-					{			
-						int idx_uv = uv_indices_in[i];
-						pnt.uv = uv_in[idx_uv];
-					}
-					else
-					{			
-						pnt.uv = uv_in[i];
-					}
-					uint64_t hash = crc64(0, (unsigned char*)&pnt, sizeof(pnt));
-
-					auto iter = points_map.find(hash);
-					if (iter != points_map.end())
-					{						
-						faceVertexIndices_out[i] = iter->second;
-					}
-					else
-					{
-						int idx_out = (int)points_out.size();
-						points_out.push_back(points_in[pnt.ind_pnt]);
-						if (norms_in.size() > 0)
-						{
-							norms_out.push_back(norms_in[pnt.ind_pnt]);
-						}
-
-						if (num_targets > 0)
-						{							
-							for (size_t j = 0; j < num_targets; j++)
-							{								
-								offsets_out[j].push_back(offsets_in[j][pnt.ind_pnt]);							
-								if (norm_offsets_in[j].size() > 0)
-								{
-									norm_offsets_out[j].push_back(norm_offsets_in[j][pnt.ind_pnt]);
-								}								
-								non_zeros_out[j].push_back(non_zeros_in[j][pnt.ind_pnt]);								
-							}
-							
-						}
-
-						if (conv_ji_in.size() > 0)
-						{
-							conv_ji_out.push_back(conv_ji_in[pnt.ind_pnt]);
-							conv_jw_out.push_back(conv_jw_in[pnt.ind_pnt]);
-						}
-						uv_out.push_back(pnt.uv);
-						faceVertexIndices_out[i] = idx_out;						
-					}
-				}								
+					src_point.push_back(point);
+					src_corner.push_back((int)corner);
+					src_face.push_back((int)face);
+				}
+			}
+		}
 
-				size_t idx_ind = 0;
-				for (size_t i = 0; i < faceVertexCounts.size(); i++)
-				{
-					int count = faceVertexCounts[i];
-					if (count == 3)
-					{
-						glm::ivec3 face;
-						if (leftHand)
-						{
-							face.z = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face.y = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face.x = faceVertexIndices_out[idx_ind]; idx_ind++;
-						}
-						else
-						{
-							face.x = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face.y = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face.z = faceVertexIndices_out[idx_ind]; idx_ind++;
-						}
-						faces.push_back(face);
-					}
-					else if (count == 4)
-					{
-						glm::ivec3 face1;
-						if (leftHand)
-						{
-							face1.z = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face1.y = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face1.x = faceVertexIndices_out[idx_ind]; idx_ind++;
-						}
-						else
-						{
-							face1.x = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face1.y = faceVertexIndices_out[idx_ind]; idx_ind++;
-							face1.z = faceVertexIndices_out[idx_ind]; idx_ind++;
-						}
-						faces.push_back(face1);
+		usd2glb_triangulate(faceVertexCounts, faceVertexIndices_out, leftHand, prim.faces);
+	}
+	else
+	{
+		usd2glb_triangulate(faceVertexCounts, faceVertexIndices, leftHand, prim.faces);
 
-						glm::ivec3 face2;
-						face2.x = face1.z;
-						face2.y = faceVertexIndices_out[idx_ind]; idx_ind++;
-						face2.z = face1.x;
-						faces.push_back(face2);
-					}
-				}
+		src_point.resize(points_in.size());
+		for (size_t i = 0; i < src_point.size(); i++) src_point[i] = (int)i;
+	}
 
-				offset = buf_out.data.size();
-				length = points_out.size() * sizeof(glm::vec3);
-				buf_out.data.resize(offset + length);
-				memcpy(buf_out.data.data() + offset, points_out.data(), length);
+	size_t num_verts = src_point.size();
+	prim.points.resize(num_verts);
+	for (size_t i = 0; i < num_verts; i++)
+	{
+		prim.points[i] = points_in[src_point[i]];
+	}
 
-				view_id = m_out.bufferViews.size();
-				{
-					tinygltf::BufferView view;
-					view.buffer = 0;
-					view.byteOffset = offset;
-					view.byteLength = length;
-					view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-					m_out.bufferViews.push_back(view);
-				}
+	for (size_t i = 0; i < primvars.size(); i++)
+	{
+		const Mid::Primvar& primvar = primvars[i];
+		std::vector<float> values(num_verts * primvar.num_comps);
+		for (size_t j = 0; j < num_verts; j++)
+		{
+			size_t corner = src_corner.size() > 0 ? src_corner[j] : 0;
+			size_t face = src_face.size() > 0 ? src_face[j] : 0;
+			memcpy(&values[j * primvar.num_comps], primvar.Value(corner, src_point[j], face), primvar.num_comps * sizeof(float));
+		}
 
-				acc_id = m_out.accessors.size();
-				{
-					tinygltf::Accessor acc;
-					acc.bufferView = view_id;
-					acc.byteOffset = 0;
-					acc.type = TINYGLTF_TYPE_VEC3;
-					acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-					acc.count = points_out.size();
-					acc.minValues = { extent.lower[0], extent.lower[1], extent.lower[2] };
-					acc.maxValues = { extent.upper[0], extent.upper[1], extent.upper[2] };
-					m_out.accessors.push_back(acc);
-				}
+		if (primvar.target == Mid::Primvar::NORMAL)
+		{
+			prim.norms.resize(num_verts);
+			for (size_t j = 0; j < num_verts; j++)
+			{
+				prim.norms[j] = glm::vec3(values[j * 3], values[j * 3 + 1], values[j * 3 + 2]);
+			}
+		}
+		else if (primvar.target == Mid::Primvar::TEXCOORD)
+		{
+			std::vector<glm::vec2> uvs(num_verts);
+			for (size_t j = 0; j < num_verts; j++)
+			{
+				uvs[j] = glm::vec2(values[j * 2], 1.0f - values[j * 2 + 1]);
+			}
+			prim.uvs.push_back(std::move(uvs));
+		}
+		else
+		{
+			prim.colors.resize(num_verts);
+			for (size_t j = 0; j < num_verts; j++)
+			{
+				prim.colors[j] = glm::vec3(values[j * 3], values[j * 3 + 1], values[j * 3 + 2]);
+			}
+		}
+	}
 
-				prim_out.attributes["POSITION"] = acc_id;
+	if (conv_ji_in.size() == points_in.size())
+	{
+		prim.joints.resize(num_verts);
+		prim.weights.resize(num_verts);
+		for (size_t i = 0; i < num_verts; i++)
+		{
+			prim.joints[i] = conv_ji_in[src_point[i]];
+			prim.weights[i] = conv_jw_in[src_point[i]];
+		}
+	}
 
-				if (norms_out.size() > 0)
+	// Carry the targets through the weld: a point's deltas go to every vertex made from it.
+	if (targets_in.size() > 0)
+	{
+		std::vector<int> point_vert_offsets(points_in.size() + 1, 0);
+		for (size_t i = 0; i < num_verts; i++) point_vert_offsets[src_point[i] + 1]++;
+		for (size_t i = 0; i < points_in.size(); i++) point_vert_offsets[i + 1] += point_vert_offsets[i];
+		std::vector<int> point_verts(num_verts);
+		std::vector<int> point_fill(point_vert_offsets.begin(), point_vert_offsets.end() - 1);
+		for (size_t i = 0; i < num_verts; i++) point_verts[point_fill[src_point[i]]++] = (int)i;
+
+		prim.targets.resize(targets_in.size());
+		for (size_t j = 0; j < targets_in.size(); j++)
+		{
+			Mid::MorphTarget& target_in = targets_in[j];
+			Mid::MorphTarget& target = prim.targets[j];
+			bool has_target_normals = target_in.norm_offsets.size() > 0;
+			for (size_t k = 0; k < target_in.indices.size(); k++)
+			{
+				int point = target_in.indices[k];
+				for (int e = point_vert_offsets[point]; e < point_vert_offsets[point + 1]; e++)
 				{
-					offset = buf_out.data.size();
-					length = norms_out.size() * sizeof(glm::vec3);
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, norms_out.data(), length);
+					target.indices.push_back(point_verts[e]);
+					target.offsets.push_back(target_in.offsets[k]);
+					if (has_target_normals) target.norm_offsets.push_back(target_in.norm_offsets[k]);
+				}
+			}
+			usd2glb_sort_target(target);
+			target_in = Mid::MorphTarget();
+		}
+	}
+	prim.lower = glm::vec3(extent.lower[0], extent.lower[1], extent.lower[2]);
+	prim.upper = glm::vec3(extent.upper[0], extent.upper[1], extent.upper[2]);
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-						m_out.bufferViews.push_back(view);
-					}
+	info_out.num_tris = prim.faces.size();
+	if (options.optimize_cache && prim.faces.size() > 0)
+	{
+		int* indices = &prim.faces[0].x;
+		size_t num_indices = prim.faces.size() * 3;
+		info_out.cache_optimized = true;
+		info_out.cache_before = Mid::AnalyzeVertexCache(indices, num_indices, prim.points.size());
+		Mid::OptimizeVertexCache(indices, num_indices, prim.points.size());
+		info_out.cache_after = Mid::AnalyzeVertexCache(indices, num_indices, prim.points.size());
+	}
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.type = TINYGLTF_TYPE_VEC3;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = norms_out.size();
-						m_out.accessors.push_back(acc);
-					}
+	usd2glb_reorder_vertices(prim);
 
-					prim_out.attributes["NORMAL"] = acc_id;
-				}
+	// Drop targets left without deltas. Every piece of a split keeps the same target list,
+	// as glTF requires the same number of targets in all primitives of a mesh.
+	if (options.morph_epsilon != 0.0f && prim.targets.size() > 0)
+	{
+		info_out.target_remap.resize(prim.targets.size());
+		size_t num_kept = 0;
+		for (size_t j = 0; j < prim.targets.size(); j++)
+		{
+			if (prim.targets[j].indices.size() == 0)
+			{
+				info_out.target_remap[j] = -1;
+				continue;
+			}
+			info_out.target_remap[j] = (int)num_kept;
+			if (num_kept != j) prim.targets[num_kept] = std::move(prim.targets[j]);
+			num_kept++;
+		}
+		prim.targets.resize(num_kept);
+	}
 
-				offset = buf_out.data.size();
-				length = faces.size() * sizeof(glm::ivec3);
-				buf_out.data.resize(offset + length);
-				memcpy(buf_out.data.data() + offset, faces.data(), length);
+	// Skinned meshes ignore their node's transform, so their positions stay float.
+	if (options.quantize && prim.joints.size() == 0 && prim.points.size() > 0)
+	{
+		glm::vec3 lower = glm::vec3(FLT_MAX);
+		glm::vec3 upper = glm::vec3(-FLT_MAX);
+		for (size_t i = 0; i < prim.points.size(); i++)
+		{
+			auto pos = prim.points[i];
+			lower = glm::min(lower, glm::vec3(pos[0], pos[1], pos[2]));
+			upper = glm::max(upper, glm::vec3(pos[0], pos[1], pos[2]));
+		}
 
-				view_id = m_out.bufferViews.size();
-				{
-					tinygltf::BufferView view;
-					view.buffer = 0;
-					view.byteOffset = offset;
-					view.byteLength = length;
-					view.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
-					m_out.bufferViews.push_back(view);
-				}
+		// Uniform, so normals aren't skewed by the node scale.
+		glm::vec3 half = (upper - lower) * 0.5f;
+		float scale = glm::max(half.x, glm::max(half.y, half.z));
+		prim.dequant_offset = (lower + upper) * 0.5f;
+		prim.dequant_scale = scale > 0.0f ? scale : 1.0f;
+		info_out.dequant_offset = prim.dequant_offset;
+		info_out.dequant_scale = prim.dequant_scale;
+	}
 
-				acc_id = m_out.accessors.size();
-				{
-					tinygltf::Accessor acc;
-					acc.bufferView = view_id;
-					acc.byteOffset = 0;
-					acc.type = TINYGLTF_TYPE_SCALAR;
-					acc.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
-					acc.count = faces.size() * 3;
-					m_out.accessors.push_back(acc);
-				}
+	tinygltf::Mesh mesh_out;
+	mesh_out.name = mesh_in->name;
 
-				prim_out.indices = acc_id;
+	if (options.split_u16 && prim.points.size() > 0xffff)
+	{
+		std::vector<Mid::PrimitiveData> pieces;
+		usd2glb_split(prim, 0xffff, pieces);
+		for (size_t i = 0; i < pieces.size(); i++)
+		{
+			usd2glb_primitive(pieces[i], job.idx_material, options, m_out, mesh_out, plan_out, info_out);
+		}
+	}
+	else
+	{
+		usd2glb_primitive(prim, job.idx_material, options, m_out, mesh_out, plan_out, info_out);
+	}
 
-				if (num_targets > 0)
-				{
-					prim_out.targets.resize(num_targets);
-					for (int lChannelIndex = 0; lChannelIndex < num_targets; ++lChannelIndex)
-					{
-						bool is_sparse = target_sparse[lChannelIndex];
-						auto& offsets = offsets_out[lChannelIndex];
-						auto& norm_offsets = norm_offsets_out[lChannelIndex];
-						auto& non_zeros = non_zeros_out[lChannelIndex];
+	m_out.meshes.push_back(mesh_out);
 
-						size_t num_pos = points_out.size();
+	if (options.meshopt)
+	{
+		usd2glb_meshopt(options, m_out, plan_out, info_out);
+	}
+}
 
-						{
-							std::vector<int> indices;
-							std::vector<glm::vec3> delta_pos;
-							glm::vec3 min_pos = { 0.0f, 0.0f, 0.0f };
-							glm::vec3 max_pos = { 0.0f, 0.0f, 0.0f };
+// A byte offset, length or count for an extension object. tinygltf::Value has no 64-bit
+// integer, so values past INT_MAX (a BIN buffer above 2 GiB) are written as doubles, which
+// hold them exactly up to 2^53.
+static tinygltf::Value usd2glb_size_value(size_t v)
+{
+	if (v <= (size_t)INT_MAX) return tinygltf::Value((int)v);
+	return tinygltf::Value((double)v);
+}
 
-							for (int k = 0; k < num_pos; k++)
-							{
-								if (non_zeros[k])
-								{
-									auto pos_offset = offsets[k];
-									if (pos_offset.x < min_pos.x) min_pos.x = pos_offset.x;
-									if (pos_offset.x > max_pos.x) max_pos.x = pos_offset.x;
-									if (pos_offset.y < min_pos.y) min_pos.y = pos_offset.y;
-									if (pos_offset.y > max_pos.y) max_pos.y = pos_offset.y;
-									if (pos_offset.z < min_pos.z) min_pos.z = pos_offset.z;
-									if (pos_offset.z > max_pos.z) max_pos.z = pos_offset.z;
-
-									indices.push_back(k);
-									delta_pos.push_back({ pos_offset.x, pos_offset.y, pos_offset.z });
-								}
-							}
+// Moves a converted mesh into m_out. Views in the fallback buffer (buffer 1) are placed
+// behind the ones already there, *fallback_size tracks its length.
+static void usd2glb_merge_mesh(tinygltf::Model& m_out, Mid::GlbWriter& bin_out, tinygltf::Model& part, Mid::BufferPlan& plan, const Mid::MeshInfo& info, size_t* fallback_size, int mesh_id)
+{
+	int base_view = (int)m_out.bufferViews.size();
+	int base_acc = (int)m_out.accessors.size();
 
-							if (indices.size() < 1)
-							{
-								indices.push_back(0);
-								delta_pos.push_back(glm::vec3(0.0f));
-							}
+	size_t base_offset = bin_out.Add(std::move(plan));
+	size_t base_fallback = (*fallback_size + 3) / 4 * 4;
+	if (info.fallback_size > 0) *fallback_size = base_fallback + info.fallback_size;
 
-							int num_verts = (int)indices.size();
-							acc_id = m_out.accessors.size();
-							if (is_sparse)
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
-								acc.sparse.isSparse = true;
-								acc.sparse.count = num_verts;
-
-								acc.maxValues = { max_pos.x, max_pos.y, max_pos.z };
-								acc.minValues = { min_pos.x, min_pos.y, min_pos.z };
-
-								offset = buf_out.data.size();
-								length = sizeof(int) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, indices.data(), length);
-
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+	for (size_t i = 0; i < part.bufferViews.size(); i++)
+	{
+		tinygltf::BufferView& view = part.bufferViews[i];
+		view.byteOffset += view.buffer == 1 ? base_fallback : base_offset;
+		m_out.bufferViews.push_back(view);
+	}
 
-								acc.sparse.indices.bufferView = view_id;
-								acc.sparse.indices.byteOffset = 0;
-								acc.sparse.indices.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+	for (size_t i = 0; i < info.meshopt_views.size(); i++)
+	{
+		const Mid::MeshoptView& meshopt_view = info.meshopt_views[i];
+		tinygltf::Value::Object ext;
+		ext["buffer"] = tinygltf::Value(0);
+		ext["byteOffset"] = usd2glb_size_value(base_offset + meshopt_view.offset);
+		ext["byteLength"] = usd2glb_size_value(meshopt_view.length);
+		ext["byteStride"] = tinygltf::Value((int)meshopt_view.stride);
+		ext["count"] = usd2glb_size_value(meshopt_view.count);
+		ext["mode"] = tinygltf::Value(std::string(meshopt_view.triangles ? "TRIANGLES" : "ATTRIBUTES"));
+		m_out.bufferViews[base_view + meshopt_view.view].extensions["EXT_meshopt_compression"] = tinygltf::Value(ext);
+	}
 
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_pos.data(), length);
+	for (size_t i = 0; i < part.accessors.size(); i++)
+	{
+		tinygltf::Accessor& acc = part.accessors[i];
+		if (acc.bufferView >= 0) acc.bufferView += base_view;
+		if (acc.sparse.isSparse)
+		{
+			acc.sparse.indices.bufferView += base_view;
+			acc.sparse.values.bufferView += base_view;
+		}
+		m_out.accessors.push_back(acc);
+	}
 
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+	tinygltf::Mesh& mesh_out = part.meshes[0];
+	for (size_t i = 0; i < mesh_out.primitives.size(); i++)
+	{
+		tinygltf::Primitive& prim_out = mesh_out.primitives[i];
+		for (auto& attr : prim_out.attributes) attr.second += base_acc;
+		if (prim_out.indices >= 0) prim_out.indices += base_acc;
+		for (size_t j = 0; j < prim_out.targets.size(); j++)
+		{
+			for (auto& attr : prim_out.targets[j]) attr.second += base_acc;
+		}
+	}
+	m_out.meshes[mesh_id] = mesh_out;
 
-								acc.sparse.values.bufferView = view_id;
-								acc.sparse.values.byteOffset = 0;
+	part = tinygltf::Model();
+}
 
-								m_out.accessors.push_back(acc);
-							}
-							else
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
+// Decodes the source images of one output texture, packs their channels and encodes the result.
+static void usd2glb_texture(const Mid::TextureJob& job, const Mid::TextureResolver& resolver, Mid::Image& img)
+{
+	Mid::Image img0, img1;
+	if (job.tex0 != "")
+	{
+		resolver.Load(img0, job.tex0);
+	}
+	if (job.tex1 != "")
+	{
+		resolver.Load(img1, job.tex1);
+	}
 
-								acc.maxValues = { max_pos.x, max_pos.y, max_pos.z };
-								acc.minValues = { min_pos.x, min_pos.y, min_pos.z };
+	switch (job.kind)
+	{
+	case Mid::TextureJob::DIFFUSE_ALPHA:
+		img.CreateRGBA(img0, img1);
+		break;
+	case Mid::TextureJob::EMISSIVE:
+		img = std::move(img0);
+		break;
+	case Mid::TextureJob::SPECULAR_GLOSSINESS:
+		img.CreateSG(img0, img1, job.roughness);
+		break;
+	case Mid::TextureJob::METALLIC_ROUGHNESS:
+		img.CreateMR(img0, img1);
+		break;
+	}
+}
 
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_pos;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_pos.data(), length);
+// Keys a channel keeps with --reduce-keys. near(i, j) tells whether keys i and j are within
+// tolerance of each other, between(a, b, i, f) whether key i is within tolerance of keys a
+// and b interpolated at f, and at_rest(i) whether key i leaves the node at its rest pose.
+// A constant channel keeps one key, or none at rest; any other keeps the keys LINEAR or STEP
+// interpolation needs, whichever are fewer. Errors are measured at the input keys, and for
+// STEP also halfway through every input segment: the source is interpolated linearly, so
+// holding a key until the next one must stay close to the ramp between input keys too.
+template<typename Near, typename Between, typename AtRest>
+static void usd2glb_reduce_keys(const float* times, size_t count, Near near, Between between, AtRest at_rest, std::vector<size_t>& keys_out, bool* step_out)
+{
+	*step_out = false;
+	keys_out.clear();
+	if (count == 0) return;
 
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+	bool constant = true;
+	for (size_t i = 1; i < count && constant; i++)
+	{
+		constant = near(0, i);
+	}
+	if (constant)
+	{
+		if (!at_rest(0)) keys_out.push_back(0);
+		return;
+	}
 
-								acc.bufferView = view_id;
-								acc.byteOffset = 0;
-								m_out.accessors.push_back(acc);
+	Mid::ReduceKeys(count, [&](size_t a, size_t b, size_t i)
+		{
+			return between(a, b, i, (times[i] - times[a]) / (times[b] - times[a]));
+		}, keys_out);
 
-							}
+	std::vector<size_t> keys_step;
+	Mid::ReduceKeys(count, [&](size_t a, size_t, size_t i)
+		{
+			return near(a, i) && between(i - 1, i, a, 0.5f) && between(i, i + 1, a, 0.5f);
+		}, keys_step);
+	// Segments between two kept keys that are neighbours in the input aren't checked above.
+	bool step_fits = true;
+	for (size_t k = 0; k + 1 < keys_step.size() && step_fits; k++)
+	{
+		size_t a = keys_step[k];
+		if (keys_step[k + 1] == a + 1) step_fits = between(a, a + 1, a, 0.5f);
+	}
+	if (step_fits && keys_step.size() < keys_out.size())
+	{
+		keys_out.swap(keys_step);
+		*step_out = true;
+	}
+}
 
-							prim_out.targets[lChannelIndex]["POSITION"] = acc_id;
-						}
+// The keys written for one joint channel: every input key, or with reduce only the ones
+// needed to stay within tolerance, as measured by error(a, b), of the input when
+// interpolated with lerp(a, b, f).
+template<typename T, typename Lerp, typename Error>
+static void usd2glb_joint_keys(const std::vector<float>& times, const T* values, const T& rest, bool reduce, float tolerance, Lerp lerp, Error error, Mid::KeyTrack<T>& track_out)
+{
+	size_t count = times.size();
+	if (!reduce)
+	{
+		track_out.times = times;
+		track_out.values.assign(values, values + count);
+		return;
+	}
 
-						if (norm_offsets.size() > 0)
-						{
-							std::vector<int> indices;
-							std::vector<glm::vec3> delta_norm;
+	std::vector<size_t> keys;
+	usd2glb_reduce_keys(times.data(), count, [&](size_t i, size_t j)
+		{
+			return error(values[i], values[j]) <= tolerance;
+		}, [&](size_t a, size_t b, size_t i, float f)
+		{
+			return error(lerp(values[a], values[b], f), values[i]) <= tolerance;
+		}, [&](size_t i)
+		{
+			return error(values[i], rest) <= tolerance;
+		}, keys, &track_out.step);
 
-							for (int k = 0; k < num_pos; k++)
-							{
-								if (non_zeros[k])
-								{
-									auto norm_offset = norm_offsets[k];
-									indices.push_back(k);
-									delta_norm.push_back({ norm_offset.x, norm_offset.y, norm_offset.z });
-								}
-							}
+	track_out.times.resize(keys.size());
+	track_out.values.resize(keys.size());
+	for (size_t k = 0; k < keys.size(); k++)
+	{
+		track_out.times[k] = times[keys[k]];
+		track_out.values[k] = values[keys[k]];
+	}
+}
 
-							if (indices.size() < 1)
-							{
-								indices.push_back(0);
-								delta_norm.push_back(glm::vec3(0.0f));
-							}
+// Angle in radians between the rotations of two unit quaternions, accurate for tiny angles
+// unlike acos of their dot product.
+static float usd2glb_quat_angle(const glm::quat& a, const glm::quat& b)
+{
+	glm::vec4 va = glm::vec4(a.x, a.y, a.z, a.w);
+	glm::vec4 vb = glm::vec4(b.x, b.y, b.z, b.w);
+	if (glm::dot(va, vb) < 0.0f) vb = -vb;
+	return 2.0f * atan2f(glm::length(va - vb), glm::length(va + vb));
+}
 
-							int num_verts = (int)indices.size();
-							acc_id = m_out.accessors.size();
-							if (is_sparse)
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
-								acc.sparse.isSparse = true;
-								acc.sparse.count = num_verts;
-
-								offset = buf_out.data.size();
-								length = sizeof(int) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, indices.data(), length);
-
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+// What a viewer reads back from v stored as component_type, normalized unless it is FLOAT.
+static float usd2glb_round_trip(float v, int component_type)
+{
+	switch (component_type)
+	{
+	case TINYGLTF_COMPONENT_TYPE_BYTE: return Mid::DecodeSnorm(Mid::QuantizeSnorm(v, 8, 8), 8);
+	case TINYGLTF_COMPONENT_TYPE_SHORT: return Mid::DecodeSnorm(Mid::QuantizeSnorm(v, 16, 16), 16);
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: return Mid::DecodeUnorm(Mid::QuantizeUnorm(v, 8, 8), 8);
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return Mid::DecodeUnorm(Mid::QuantizeUnorm(v, 16, 16), 16);
+	}
+	return v;
+}
 
-								acc.sparse.indices.bufferView = view_id;
-								acc.sparse.indices.byteOffset = 0;
-								acc.sparse.indices.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+// Writes count floats as components of component_type, normalized unless it is FLOAT.
+static void usd2glb_write_components(const float* in, size_t count, int component_type, uint8_t* out)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		switch (component_type)
+		{
+		case TINYGLTF_COMPONENT_TYPE_BYTE: ((int8_t*)out)[i] = (int8_t)Mid::QuantizeSnorm(in[i], 8, 8); break;
+		case TINYGLTF_COMPONENT_TYPE_SHORT: ((int16_t*)out)[i] = (int16_t)Mid::QuantizeSnorm(in[i], 16, 16); break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: out[i] = (uint8_t)Mid::QuantizeUnorm(in[i], 8, 8); break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: ((uint16_t*)out)[i] = (uint16_t)Mid::QuantizeUnorm(in[i], 16, 16); break;
+		default: memcpy(out + i * sizeof(float), in + i, sizeof(float)); break;
+		}
+	}
+}
 
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_norm.data(), length);
+// Component type of rotation sampler output with --quantize: normalized BYTE or SHORT, the
+// narrowest whose largest angle error (radians, after the viewer renormalizes) stays within
+// max_error, FLOAT if neither does. Sets *error_out to the error of the chosen type.
+static int usd2glb_rotation_type(const glm::quat* values, size_t count, float max_error, double* error_out)
+{
+	const int types[] = { TINYGLTF_COMPONENT_TYPE_BYTE, TINYGLTF_COMPONENT_TYPE_SHORT };
+	for (int component_type : types)
+	{
+		float error = 0.0f;
+		for (size_t k = 0; k < count && error <= max_error; k++)
+		{
+			const glm::quat& q = values[k];
+			glm::quat q_out = glm::quat(usd2glb_round_trip(q.w, component_type), usd2glb_round_trip(q.x, component_type),
+				usd2glb_round_trip(q.y, component_type), usd2glb_round_trip(q.z, component_type));
+			error = glm::max(error, usd2glb_quat_angle(q, glm::normalize(q_out)));
+		}
+		if (error <= max_error)
+		{
+			*error_out = error;
+			return component_type;
+		}
+	}
+	*error_out = 0.0;
+	return TINYGLTF_COMPONENT_TYPE_FLOAT;
+}
 
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+// Component type of blend shape weights sampler output with --quantize: normalized unsigned
+// for weights in [0, 1], signed in [-1, 1], 8 bits if the largest error stays within
+// max_error, else 16 bits, FLOAT if that isn't enough or a weight is out of range.
+static int usd2glb_weight_type(const float* weights, size_t count, float max_error, double* error_out)
+{
+	float lower = 0.0f;
+	float upper = 0.0f;
+	for (size_t k = 0; k < count; k++)
+	{
+		lower = glm::min(lower, weights[k]);
+		upper = glm::max(upper, weights[k]);
+	}
+	*error_out = 0.0;
+	if (lower < -1.0f || upper > 1.0f) return TINYGLTF_COMPONENT_TYPE_FLOAT;
 
-								acc.sparse.values.bufferView = view_id;
-								acc.sparse.values.byteOffset = 0;
+	int types[2] = { TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT };
+	if (lower < 0.0f)
+	{
+		types[0] = TINYGLTF_COMPONENT_TYPE_BYTE;
+		types[1] = TINYGLTF_COMPONENT_TYPE_SHORT;
+	}
+	for (int component_type : types)
+	{
+		float error = 0.0f;
+		for (size_t k = 0; k < count && error <= max_error; k++)
+		{
+			error = glm::max(error, fabsf(usd2glb_round_trip(weights[k], component_type) - weights[k]));
+		}
+		if (error <= max_error)
+		{
+			*error_out = error;
+			return component_type;
+		}
+	}
+	return TINYGLTF_COMPONENT_TYPE_FLOAT;
+}
 
-								m_out.accessors.push_back(acc);
-							}
-							else
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
-
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_pos;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_norm.data(), length);
-
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+// Accessor of the keyframe times of a sampler, writing them only if no earlier sampler of
+// the animation has the same times. Adds the bytes saved to *bytes_shared.
+static int usd2glb_time_accessor(const float* times, size_t count, Mid::TimeAccessorCache& cache, tinygltf::Model& m_out, Mid::GlbWriter& bin_out, size_t* bytes_shared)
+{
+	size_t length = sizeof(float) * count;
+	int acc_id = cache.Find(times, count);
+	if (acc_id >= 0)
+	{
+		*bytes_shared += length;
+		return acc_id;
+	}
 
-								acc.bufferView = view_id;
-								acc.byteOffset = 0;
+	size_t offset = bin_out.Add(times, length);
 
-								m_out.accessors.push_back(acc);
-							}
+	int view_id = (int)m_out.bufferViews.size();
+	{
+		tinygltf::BufferView view;
+		view.buffer = 0;
+		view.byteOffset = offset;
+		view.byteLength = length;
+		m_out.bufferViews.push_back(view);
+	}
 
-							prim_out.targets[lChannelIndex]["NORMAL"] = acc_id;
-						}
+	acc_id = (int)m_out.accessors.size();
+	{
+		tinygltf::Accessor acc;
+		acc.bufferView = view_id;
+		acc.byteOffset = 0;
+		acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+		acc.count = count;
+		acc.type = TINYGLTF_TYPE_SCALAR;
+		acc.minValues = { times[0] };
+		acc.maxValues = { times[count - 1] };
+		m_out.accessors.push_back(acc);
+	}
 
+	cache.Insert(times, count, acc_id);
+	return acc_id;
+}
 
-					}
-				}
+static int usd2glb_stage(tinyusdz::Stage& stage, const Mid::TextureResolver& resolver, const usd2glb_options& options, tinygltf::Model& m_out, Mid::GlbWriter& bin_out)
+{
+	Mid::StageTimer timer;
+	timer.enabled = options.report != 0;
 
-				size_t uv_count = uv_out.size();
-				offset = buf_out.data.size();
-				length = uv_count * sizeof(glm::vec2);
-				buf_out.data.resize(offset + length);
-				float* p_uv = (float*)(buf_out.data.data() + offset);
-				for (size_t i = 0; i < uv_count; i++)
-				{
-					p_uv[i * 2] = uv_out[i][0];
-					p_uv[i * 2 + 1] = 1.0f - uv_out[i][1];
-				}				
+	// tinyusdz::usda::SaveAsUSDA("output.usda", stage, &warn, &err);
+	
+	double time_codes_per_sec = stage.metas().timeCodesPerSecond.get_value();
+	auto upAxis = stage.metas().upAxis.get_value();
 
-				view_id = m_out.bufferViews.size();
-				{
-					tinygltf::BufferView view;
-					view.buffer = 0;
-					view.byteOffset = offset;
-					view.byteLength = length;
-					view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-					m_out.bufferViews.push_back(view);
-				}
+	glm::quat axis_rot = glm::identity<glm::quat>();
+	if (upAxis == tinyusdz::Axis::X)
+	{
+		glm::mat4 rot = { 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+		axis_rot = rot;
+	}
+	else if (upAxis == tinyusdz::Axis::Z)
+	{
+		glm::mat4 rot = { 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+		axis_rot = rot;
+	}
+	
+	tinyusdz::Prim* root_prim = &stage.root_prims()[0];
+	
+	m_out.scenes.resize(1);
+	tinygltf::Scene& scene_out = m_out.scenes[0];
+	scene_out.name = "Scene";
 
-				acc_id = m_out.accessors.size();
-				{
-					tinygltf::Accessor acc;
-					acc.bufferView = view_id;
-					acc.byteOffset = 0;
-					acc.type = TINYGLTF_TYPE_VEC2;
-					acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-					acc.count = uv_count;
-					m_out.accessors.push_back(acc);
-				}
+	m_out.asset.version = "2.0";
+	m_out.asset.generator = "tinygltf";
 
-				prim_out.attributes["TEXCOORD_0"] = acc_id;
+	size_t offset = 0;
+	size_t length = 0;
+	size_t view_id = 0;
+	size_t acc_id = 0;
 
-				if (conv_ji_out.size() > 0)
-				{
-					size_t count = conv_ji_out.size();
+	std::vector<Mid::Material> material_lst;
+	std::unordered_map<std::string, int> material_map;
 
-					offset = buf_out.data.size();
-					length = sizeof(glm::u8vec4) * count;
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, conv_ji_out.data(), length);
+	struct Prim
+	{
+		tinyusdz::Prim* prim;
+		int id_node_base = -1;
+		int idx_material = -1;
+		std::string skel_path;
+	};
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-						m_out.bufferViews.push_back(view);
-					}
+	Mid::PrimIndex prim_index;
+	prim_index.Build(root_prim);
+	timer.Lap("prim index");
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
-						acc.count = count;
-						acc.type = TINYGLTF_TYPE_VEC4;
-						m_out.accessors.push_back(acc);
-					}
+	bool specular_used = false;
 
-					prim_out.attributes["JOINTS_0"] = acc_id;
+	for (size_t i = 0; i < prim_index.materials.size(); i++)
+	{
+		const Mid::PrimIndex::Entry& entry = prim_index.entries[prim_index.materials[i]];
+		const std::string& path = prim_index.paths[entry.path];
 
-					offset = buf_out.data.size();
-					length = sizeof(glm::vec4) * count;
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, conv_jw_out.data(), length);
+		Mid::Material material_mid;
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-						m_out.bufferViews.push_back(view);
-					}
+		auto* material_in = entry.prim->data().as<tinyusdz::Material>();
+		material_mid.name = material_in->name;
+		const std::vector<tinyusdz::Path>& connections = material_in->surface.get_connections();
+		auto ppath = connections[0].get_parent_path();
+		nonstd::expected<const tinyusdz::Prim*, std::string> pshader0 = stage.GetPrimAtPath(ppath);
+		const tinyusdz::Prim* prim = pshader0.value();
+		auto* shader0 = prim->data().as<tinyusdz::Shader>();
+		auto* surface = shader0->value.as<tinyusdz::UsdPreviewSurface>();
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = count;
-						acc.type = TINYGLTF_TYPE_VEC4;
-						m_out.accessors.push_back(acc);
-					}
+		int useSpecularWorkflow;
+		surface->useSpecularWorkflow.get_value().get_scalar(&useSpecularWorkflow);			
+		material_mid.useSpecularWorkflow = useSpecularWorkflow != 0;		
 
-					prim_out.attributes["WEIGHTS_0"] = acc_id;
+		specular_used = specular_used || material_mid.useSpecularWorkflow;
 
-				}
-			}
-			else
+		{
+			auto diffuse = surface->diffuseColor;
+			auto diffuse_connection = diffuse.get_connection();
+
+			if (diffuse_connection.has_value())
 			{
-				size_t idx_ind = 0;
-				for (size_t i = 0; i < faceVertexCounts.size(); i++)
+				std::string path = diffuse_connection.value().prim_part();
+				const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
+				auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
+				if (shader1->value.type_id() == tinyusdz::value::TYPE_ID_IMAGING_UVTEXTURE)
 				{
-					int count = faceVertexCounts[i];
-					if (count == 3)
-					{
-						glm::ivec3 face;
-						if (leftHand)
-						{
-							face.z = faceVertexIndices[idx_ind]; idx_ind++;
-							face.y = faceVertexIndices[idx_ind]; idx_ind++;
-							face.x = faceVertexIndices[idx_ind]; idx_ind++;
-						}
-						else
-						{
-							face.x = faceVertexIndices[idx_ind]; idx_ind++;
-							face.y = faceVertexIndices[idx_ind]; idx_ind++;
-							face.z = faceVertexIndices[idx_ind]; idx_ind++;
-						}
-						faces.push_back(face);
-					}
-					else if (count == 4)
+					auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
+					tinyusdz::value::AssetPath file;
+					tex->file.get_value().value().get_scalar(&file);
+					material_mid.diffuse_tex = file.GetAssetPath();
+
+					auto uv_connection = tex->st.get_connection();
+					if (uv_connection.has_value())
 					{
-						glm::ivec3 face1;
-						if (leftHand)
+						std::string path_uv = uv_connection.value().prim_part();
+						const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
+						const tinyusdz::Shader* shader2 = pshader2->data().as<tinyusdz::Shader>();
+						auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
+						
+						if (uvset->varname.is_connection() == true)
 						{
-							face1.z = faceVertexIndices[idx_ind]; idx_ind++;
-							face1.y = faceVertexIndices[idx_ind]; idx_ind++;
-							face1.x = faceVertexIndices[idx_ind]; idx_ind++;
+							nonstd::optional<tinyusdz::Path> varname_connectionOpt = uvset->varname.get_connection();
+							if (varname_connectionOpt.has_value())
+							{
+								tinyusdz::Path varname_connection = varname_connectionOpt.value();
+								std::string path_varname = varname_connection.prim_part();
+								std::string prop = varname_connection.prop_part();
+								const tinyusdz::Prim* prim_varname = stage.GetPrimAtPath(tinyusdz::Path(path_varname, "")).value();
+								auto* material_inB = prim_varname->data().as<tinyusdz::Material>();
+								if (material_inB)
+								{
+									auto propPairIt = material_inB->props.find(prop);
+									if (propPairIt != std::end(material_inB->props))
+									{
+										tinyusdz::Property property = propPairIt->second;
+										if (property.is_attribute())
+										{
+											tinyusdz::Attribute attribute = property.get_attribute();
+											tinyusdz::value::token propToken = attribute.get_value<tinyusdz::value::token>().value();
+											material_mid.uvset = propToken.str();
+										}
+									}
+								}
+							}
 						}
 						else
 						{
-							face1.x = faceVertexIndices[idx_ind]; idx_ind++;
-							face1.y = faceVertexIndices[idx_ind]; idx_ind++;
-							face1.z = faceVertexIndices[idx_ind]; idx_ind++;
+						tinyusdz::value::token token_uv;
+						uvset->varname.get_value().value().get_scalar(&token_uv);
+						material_mid.uvset = token_uv.str();
 						}
-						faces.push_back(face1);
-
-						glm::ivec3 face2;
-						face2.x = face1.z;
-						face2.y = faceVertexIndices[idx_ind]; idx_ind++;
-						face2.z = face1.x;
-						faces.push_back(face2);
 					}
 				}
-
-				offset = buf_out.data.size();
-				length = points_in.size() * sizeof(glm::vec3);
-				buf_out.data.resize(offset + length);
-				memcpy(buf_out.data.data() + offset, points_in.data(), length);
-
-				view_id = m_out.bufferViews.size();
+				else if (shader1->value.type_id() == tinyusdz::value::TYPE_ID_IMAGING_PRIMVAR_READER_FLOAT3)
 				{
-					tinygltf::BufferView view;
-					view.buffer = 0;
-					view.byteOffset = offset;
-					view.byteLength = length;
-					view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-					m_out.bufferViews.push_back(view);
+					auto* reader = shader1->value.as<tinyusdz::UsdPrimvarReader_float3>();						
+					tinyusdz::value::token varname;
+					reader->varname.get_value().value().get_scalar(&varname);
+					material_mid.diffuse_varname = varname.str();
 				}
+				material_mid.diffuse_color = { 1.0f, 1.0f, 1.0f };
+			}
+			else
+			{
+				tinyusdz::value::color3f col;
+				diffuse.get_value().get_scalar(&col);
+				material_mid.diffuse_color = { col[0], col[1], col[2] };
+			}
+
+		}
 
-				acc_id = m_out.accessors.size();
+		{
+			auto emissive = surface->emissiveColor;
+			auto emissive_connection = emissive.get_connection();
+			if (emissive_connection.has_value())
+			{
+				std::string path = emissive_connection.value().prim_part();
+				const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
+				auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
+				auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
+				tinyusdz::value::AssetPath file;
+				tex->file.get_value().value().get_scalar(&file);
+				material_mid.emissive_tex = file.GetAssetPath();
+
+				auto uv_connection = tex->st.get_connection();
+				if (uv_connection.has_value())
 				{
-					tinygltf::Accessor acc;
-					acc.bufferView = view_id;
-					acc.byteOffset = 0;
-					acc.type = TINYGLTF_TYPE_VEC3;
-					acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-					acc.count = points_in.size();
-					acc.minValues = { extent.lower[0], extent.lower[1], extent.lower[2] };
-					acc.maxValues = { extent.upper[0], extent.upper[1], extent.upper[2] };
-					m_out.accessors.push_back(acc);
+					std::string path_uv = uv_connection.value().prim_part();
+					const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
+					auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
+					auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
+					tinyusdz::value::token token_uv;
+					uvset->varname.get_value().value().get_scalar(&token_uv);
+					material_mid.uvset = token_uv.str();
 				}
+				material_mid.emissive_color = { 1.0f, 1.0f, 1.0f };
+			}
+			else
+			{
+				tinyusdz::value::color3f col;
+				emissive.get_value().get_scalar(&col);
+				material_mid.emissive_color = { col[0], col[1], col[2] };
+			}
+		}
 
-				prim_out.attributes["POSITION"] = acc_id;
-
-				if (norms_in.size() > 0)
+		if (material_mid.useSpecularWorkflow)
+		{
+			auto specular = surface->specularColor;
+			auto specular_connection = specular.get_connection();
+			if (specular_connection.has_value())
+			{
+				std::string path = specular_connection.value().prim_part();
+				const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
+				auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
+				auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
+				tinyusdz::value::AssetPath file;
+				tex->file.get_value().value().get_scalar(&file);
+				material_mid.specular_tex = file.GetAssetPath();
+
+				auto uv_connection = tex->st.get_connection();
+				if (uv_connection.has_value())
 				{
-					offset = buf_out.data.size();
-					length = norms_in.size() * sizeof(glm::vec3);
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, norms_in.data(), length);
-
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-						m_out.bufferViews.push_back(view);
-					}
-
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.type = TINYGLTF_TYPE_VEC3;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = norms_in.size();
-						m_out.accessors.push_back(acc);
-					}
-
-					prim_out.attributes["NORMAL"] = acc_id;
+					std::string path_uv = uv_connection.value().prim_part();
+					const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
+					auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
+					auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
+					tinyusdz::value::token token_uv;
+					uvset->varname.get_value().value().get_scalar(&token_uv);
+					material_mid.uvset = token_uv.str();
 				}
-
-				offset = buf_out.data.size();
-				length = faces.size() * sizeof(glm::ivec3);
-				buf_out.data.resize(offset + length);
-				memcpy(buf_out.data.data() + offset, faces.data(), length);
-
-				view_id = m_out.bufferViews.size();
+				material_mid.specular_color = { 1.0f, 1.0f, 1.0f };
+			}			
+			else
+			{
+				tinyusdz::value::color3f col;
+				specular.get_value().get_scalar(&col);
+				material_mid.specular_color = { col[0], col[1], col[2] };
+			}
+		}
+		else
+		{
+			auto metallic = surface->metallic;
+			auto metallic_connection = metallic.get_connection();
+			if (metallic_connection.has_value())
+			{
+				std::string path = metallic_connection.value().prim_part();
+				const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
+				auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
+				auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
+				tinyusdz::value::AssetPath file;
+				tex->file.get_value().value().get_scalar(&file);
+				material_mid.metallic_tex = file.GetAssetPath();
+				material_mid.metallic = 1.0f;
+
+				auto uv_connection = tex->st.get_connection();
+				if (uv_connection.has_value())
 				{
-					tinygltf::BufferView view;
-					view.buffer = 0;
-					view.byteOffset = offset;
-					view.byteLength = length;
-					view.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
-					m_out.bufferViews.push_back(view);
+					std::string path_uv = uv_connection.value().prim_part();
+					const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
+					auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
+					auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
+					tinyusdz::value::token token_uv;
+					uvset->varname.get_value().value().get_scalar(&token_uv);
+					material_mid.uvset = token_uv.str();
 				}
-
-				acc_id = m_out.accessors.size();
+			}
+			else
+			{
+				metallic.get_value().get_scalar(&material_mid.metallic);
+			}
+		}
+		{
+			auto roughness = surface->roughness;
+			auto roughness_connection = roughness.get_connection();
+			if (roughness_connection.has_value())
+			{
+				std::string path = roughness_connection.value().prim_part();
+				const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
+				auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
+				auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
+				tinyusdz::value::AssetPath file;
+				tex->file.get_value().value().get_scalar(&file);
+				material_mid.roughness_tex = file.GetAssetPath();
+				material_mid.roughness = 1.0f;
+
+				auto uv_connection = tex->st.get_connection();
+				if (uv_connection.has_value())
 				{
-					tinygltf::Accessor acc;
-					acc.bufferView = view_id;
-					acc.byteOffset = 0;
-					acc.type = TINYGLTF_TYPE_SCALAR;
-					acc.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
-					acc.count = faces.size() * 3;
-					m_out.accessors.push_back(acc);
+					std::string path_uv = uv_connection.value().prim_part();
+					const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
+					auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
+					auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
+					tinyusdz::value::token token_uv;
+					uvset->varname.get_value().value().get_scalar(&token_uv);
+					material_mid.uvset = token_uv.str();
 				}
-
-				prim_out.indices = acc_id;
-
-				int num_targets = offsets_in.size();
-				if (num_targets > 0)
+			}
+			else
+			{
+				roughness.get_value().get_scalar(&material_mid.roughness);
+			}
+		}
+		{
+			auto opacity = surface->opacity;
+			auto opacity_connection = opacity.get_connection();
+			if (opacity_connection.has_value())
+			{
+				std::string path = opacity_connection.value().prim_part();
+				const tinyusdz::Prim* pshader1 = stage.GetPrimAtPath(tinyusdz::Path(path, "")).value();
+				auto* shader1 = pshader1->data().as<tinyusdz::Shader>();
+				auto* tex = shader1->value.as<tinyusdz::UsdUVTexture>();
+				tinyusdz::value::AssetPath file;
+				tex->file.get_value().value().get_scalar(&file);
+				material_mid.opacity_tex = file.GetAssetPath();
+				material_mid.opacity = 1.0f;
+
+				auto uv_connection = tex->st.get_connection();
+				if (uv_connection.has_value())
 				{
-					prim_out.targets.resize(num_targets);
-					for (int lChannelIndex = 0; lChannelIndex < num_targets; ++lChannelIndex)
-					{
-						bool is_sparse = target_sparse[lChannelIndex];
-						auto& offsets = offsets_in[lChannelIndex];
-						auto& norm_offsets = norm_offsets_in[lChannelIndex];
-						auto& non_zeros = non_zeros_in[lChannelIndex];
-
-						size_t num_pos = points_in.size();
-
-						{
-							std::vector<int> indices;
-							std::vector<glm::vec3> delta_pos;
-							glm::vec3 min_pos = { 0.0f, 0.0f, 0.0f };
-							glm::vec3 max_pos = { 0.0f, 0.0f, 0.0f };
-
-							for (int k = 0; k < num_pos; k++)
-							{
-								if (non_zeros[k])
-								{
-									auto pos_offset = offsets[k];
-									if (pos_offset.x < min_pos.x) min_pos.x = pos_offset.x;
-									if (pos_offset.x > max_pos.x) max_pos.x = pos_offset.x;
-									if (pos_offset.y < min_pos.y) min_pos.y = pos_offset.y;
-									if (pos_offset.y > max_pos.y) max_pos.y = pos_offset.y;
-									if (pos_offset.z < min_pos.z) min_pos.z = pos_offset.z;
-									if (pos_offset.z > max_pos.z) max_pos.z = pos_offset.z;
-
-									indices.push_back(k);
-									delta_pos.push_back({ pos_offset.x, pos_offset.y, pos_offset.z });
-								}
-							}
-
-							if (indices.size() < 1)
-							{
-								indices.push_back(0);
-								delta_pos.push_back(glm::vec3(0.0f));
-							}
-
-							int num_verts = (int)indices.size();
-							acc_id = m_out.accessors.size();
-							if (is_sparse)
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
-								acc.sparse.isSparse = true;
-								acc.sparse.count = num_verts;
-
-								acc.maxValues = { max_pos.x, max_pos.y, max_pos.z };
-								acc.minValues = { min_pos.x, min_pos.y, min_pos.z };
-
-								offset = buf_out.data.size();
-								length = sizeof(int) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, indices.data(), length);
-
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
-
-								acc.sparse.indices.bufferView = view_id;
-								acc.sparse.indices.byteOffset = 0;
-								acc.sparse.indices.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
-
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_pos.data(), length);
-
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+					std::string path_uv = uv_connection.value().prim_part();
+					const tinyusdz::Prim* pshader2 = stage.GetPrimAtPath(tinyusdz::Path(path_uv, "")).value();
+					auto* shader2 = pshader2->data().as<tinyusdz::Shader>();
+					auto* uvset = shader2->value.as<tinyusdz::UsdPrimvarReader_float2>();
+					tinyusdz::value::token token_uv;
+					uvset->varname.get_value().value().get_scalar(&token_uv);
+					material_mid.uvset = token_uv.str();
+				}
+			}
+			else
+			{
+				opacity.get_value().get_scalar(&material_mid.opacity);					
+			}
 
-								acc.sparse.values.bufferView = view_id;
-								acc.sparse.values.byteOffset = 0;
+		}
 
-								m_out.accessors.push_back(acc);
-							}
-							else
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
+		int idx = (int)material_lst.size();
+		material_lst.push_back(material_mid);
+		material_map[path] = idx;
+	}
 
-								acc.maxValues = { max_pos.x, max_pos.y, max_pos.z };
-								acc.minValues = { min_pos.x, min_pos.y, min_pos.z };
+	if (specular_used)
+	{
+		m_out.extensionsUsed.push_back("KHR_materials_pbrSpecularGlossiness");
+	}
+	timer.Lap("materials");
 
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_pos;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_pos.data(), length);
+	std::unordered_map<std::string, int> joint_map;
+	std::unordered_map<int, std::string> node_skin_map;
+	std::unordered_map<std::string, int> skin_map;
 
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+	struct MorphIdx
+	{
+		int node_idx;
+		int morph_idx;
+	};
 
-								acc.bufferView = view_id;
-								acc.byteOffset = 0;
-								m_out.accessors.push_back(acc);
+	std::unordered_map<std::string, std::vector<MorphIdx>> morph_map;
+	std::unordered_map<int, int> target_counts;
 
-							}
+	std::vector<Mid::MeshJob> mesh_jobs;
 
-							prim_out.targets[lChannelIndex]["POSITION"] = acc_id;
-						}
+	std::vector<int> node_base(prim_index.entries.size(), -1);
+	for (size_t idx_entry = 0; idx_entry < prim_index.entries.size(); idx_entry++)
+	{
+		const Mid::PrimIndex::Entry& entry = prim_index.entries[idx_entry];
+		const std::string& path = prim_index.paths[entry.path];
 
-						if (norm_offsets.size() > 0)
-						{
-							std::vector<int> indices;
-							std::vector<glm::vec3> delta_norm;
+		Prim prim;
+		prim.prim = entry.prim;
+		prim.id_node_base = entry.parent >= 0 ? node_base[entry.parent] : -1;
+		if (entry.material_path >= 0)
+		{
+			prim.idx_material = material_map[prim_index.paths[entry.material_path]];
+		}
+		prim.skel_path = prim_index.Path(entry.skel_path);
 
-							for (int k = 0; k < num_pos; k++)
-							{
-								if (non_zeros[k])
-								{
-									auto norm_offset = norm_offsets[k];
-									indices.push_back(k);
-									delta_norm.push_back({ norm_offset.x, norm_offset.y, norm_offset.z });
-								}								
-							}
+		if (entry.type_id == tinyusdz::value::TYPE_ID_GEOM_XFORM)
+		{
+			auto* node_in = prim.prim->data().as<tinyusdz::Xform>();
 
-							if (indices.size() < 1)
-							{
-								indices.push_back(0);
-								delta_norm.push_back(glm::vec3(0.0f));
-							}
+			int node_id = (int)m_out.nodes.size();
 
-							int num_verts = (int)indices.size();
-							acc_id = m_out.accessors.size();
-							if (is_sparse)
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
-								acc.sparse.isSparse = true;
-								acc.sparse.count = num_verts;
-
-								offset = buf_out.data.size();
-								length = sizeof(int) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, indices.data(), length);
-
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+			tinygltf::Node node_out;
+			node_out.name = node_in->name;
 
-								acc.sparse.indices.bufferView = view_id;
-								acc.sparse.indices.byteOffset = 0;
-								acc.sparse.indices.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+			tinyusdz::value::matrix4d matrix;
+			node_in->EvaluateXformOps(0.0, tinyusdz::value::TimeSampleInterpolationType::Linear, &matrix, nullptr, nullptr);
 
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_verts;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_norm.data(), length);
+			glm::mat4 mat = mat_convert(matrix);
+			glm::vec3 scale;
+			glm::quat rotation;
+			glm::vec3 translation;
 
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+			glm::vec3 skew;
+			glm::vec4 persp;
+			glm::decompose(mat, scale, rotation, translation, skew, persp);
 
-								acc.sparse.values.bufferView = view_id;
-								acc.sparse.values.byteOffset = 0;
+			node_out.translation = { translation.x, translation.y, translation.z };
+			node_out.rotation = { rotation.x, rotation.y, rotation.z, rotation.w };
+			node_out.scale = { scale.x, scale.y, scale.z };
 
-								m_out.accessors.push_back(acc);
-							}
-							else
-							{
-								tinygltf::Accessor acc;
-								acc.byteOffset = 0;
-								acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-								acc.count = (size_t)(num_pos);
-								acc.type = TINYGLTF_TYPE_VEC3;
-
-								offset = buf_out.data.size();
-								length = sizeof(glm::vec3) * num_pos;
-								buf_out.data.resize(offset + length);
-								memcpy(buf_out.data.data() + offset, delta_norm.data(), length);
-
-								view_id = m_out.bufferViews.size();
-								{
-									tinygltf::BufferView view;
-									view.buffer = 0;
-									view.byteOffset = offset;
-									view.byteLength = length;
-									m_out.bufferViews.push_back(view);
-								}
+			m_out.nodes.push_back(node_out);
+			if (prim.id_node_base >= 0)
+			{
+				m_out.nodes[prim.id_node_base].children.push_back(node_id);
+			}
+			else
+			{
+				rotation = axis_rot * rotation;
+				node_out.rotation = { rotation.x, rotation.y, rotation.z, rotation.w };
+				scene_out.nodes.push_back(node_id);
+			}
+			prim.id_node_base = node_id;
+		}
+		else if (entry.type_id == tinyusdz::value::TYPE_ID_SKEL_ROOT)
+		{
+			auto* node_in = prim.prim->data().as<tinyusdz::SkelRoot>();
+			int node_id = (int)m_out.nodes.size();
 
-								acc.bufferView = view_id;
-								acc.byteOffset = 0;
+			tinygltf::Node node_out;
+			node_out.name = node_in->name;
+			
+			for (size_t i = 0; i < node_in->xformOps.size(); i++)
+			{
+				auto& op = node_in->xformOps[i];				
+				if (op.op_type == tinyusdz::XformOp::OpType::Transform)
+				{
+					auto* matrix = op.get_scalar().value().as<tinyusdz::value::matrix4d>();
 
-								m_out.accessors.push_back(acc);
-							}
+					glm::mat4 mat = mat_convert(*matrix);
+					glm::vec3 scale;
+					glm::quat rotation;
+					glm::vec3 translation;
 
-							prim_out.targets[lChannelIndex]["NORMAL"] = acc_id;
-						}
+					glm::vec3 skew;
+					glm::vec4 persp;
+					glm::decompose(mat, scale, rotation, translation, skew, persp);
 
+					rotation = axis_rot * rotation;
+					
+					node_out.translation = { translation.x, translation.y, translation.z };
+					node_out.rotation = { rotation.x, rotation.y, rotation.z, rotation.w };
+					node_out.scale = { scale.x, scale.y, scale.z };
 
-					}
+					m_out.nodes.push_back(node_out);
+					scene_out.nodes.push_back(node_id);
 
+					prim.id_node_base = node_id;
+					break;
 				}
+			}
+		}
+		else if (entry.type_id == tinyusdz::value::TYPE_ID_GEOM_MESH)
+		{
+			auto* mesh_in = prim.prim->data().as<tinyusdz::GeomMesh>();
 
-				if (uv_in.size() > 0)
-				{
-					size_t uv_count;
-					if (uv_indices_in.size() > 0)
-					{
-						uv_count = uv_indices_in.size();
-						offset = buf_out.data.size();
-						length = uv_count * sizeof(glm::vec2);
-						buf_out.data.resize(offset + length);
-						float* p_uv = (float*)(buf_out.data.data() + offset);
-						for (size_t i = 0; i < uv_count; i++)
-						{
-							int idx = uv_indices_in[i];
-							p_uv[i * 2] = uv_in[idx][0];
-							p_uv[i * 2 + 1] = 1.0f - uv_in[idx][1];
-						}
+			if (mesh_in->materialBinding.has_value())
+			{
+				std::string material_path = mesh_in->materialBinding.value().targetPath.full_path_name();
+				prim.idx_material = material_map[material_path];
+			}
 
-					}
-					else
-					{
-						uv_count = uv_in.size();
-						offset = buf_out.data.size();
-						length = uv_count * sizeof(glm::vec2);
-						buf_out.data.resize(offset + length);
-						float* p_uv = (float*)(buf_out.data.data() + offset);
-						for (size_t i = 0; i < uv_count; i++)
-						{
-							p_uv[i * 2] = uv_in[i][0];
-							p_uv[i * 2 + 1] = 1.0f - uv_in[i][1];
-						}						
-					}
+			int node_id = (int)m_out.nodes.size();
+			int mesh_id = (int)m_out.meshes.size();			
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-						m_out.bufferViews.push_back(view);
-					}
+			tinygltf::Node node_out;
+			node_out.name = mesh_in->name;
+			node_out.mesh = mesh_id;
+			m_out.nodes.push_back(node_out);			
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.type = TINYGLTF_TYPE_VEC2;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = uv_count;
-						m_out.accessors.push_back(acc);
-					}
+			if (prim.id_node_base >= 0)
+			{
+				m_out.nodes[prim.id_node_base].children.push_back(node_id);
+			}
+			else
+			{				
+				node_out.rotation = { axis_rot.x, axis_rot.y, axis_rot.z, axis_rot.w };
+				scene_out.nodes.push_back(node_id);
+			}
+			prim.id_node_base = node_id;
 
-					prim_out.attributes["TEXCOORD_0"] = acc_id;
+			Mid::MeshJob job;
+			job.mesh_in = mesh_in;
+			job.mesh_id = mesh_id;
+			job.node_id = node_id;
 
+			int idx_material = prim.idx_material;
+			if (idx_material == -1)
+			{
+				idx_material = (int)material_lst.size();
+				Mid::Material material_mid;
+				auto iter = mesh_in->props.find("primvars:displayColor");
+				if (iter != mesh_in->props.end())
+				{
+					auto col = iter->second.get_attribute().get_value<std::vector<tinyusdz::value::float3>>().value()[0];
+					material_mid.diffuse_color = { col[0], col[1], col[2] };
 				}
-
-				if (conv_ji_in.size()>0)
+				material_lst.push_back(material_mid);
+				prim.idx_material = idx_material;
+			}
+			else
+			{
+				Mid::Material material_mid = material_lst[idx_material];
+				auto iter = mesh_in->props.find("primvars:"+ material_mid.diffuse_varname);
+				if (iter != mesh_in->props.end())
 				{
-					size_t count = conv_ji_in.size();
+					auto col = iter->second.get_attribute().get_value<std::vector<tinyusdz::value::float3>>().value()[0];
+					material_mid.diffuse_color = { col[0], col[1], col[2] };
+					idx_material = (int)material_lst.size();
+					material_lst.push_back(material_mid);
+					prim.idx_material = idx_material;
+				}
+			}
 
-					offset = buf_out.data.size();
-					length = sizeof(glm::u8vec4) * count;
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, conv_ji_in.data(), length);
+			Mid::Material& material_mid = material_lst[idx_material];
+			material_mid.double_sided = mesh_in->doubleSided.get_value();
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-						m_out.bufferViews.push_back(view);
-					}
+			job.idx_material = idx_material;
+			job.uvset = material_mid.uvset;
 
-					acc_id = m_out.accessors.size();
+			{
+				auto iter_ji = mesh_in->props.find("primvars:skel:jointIndices");
+				auto iter_jw = mesh_in->props.find("primvars:skel:jointWeights");
+				if (iter_ji != mesh_in->props.end() && iter_jw != mesh_in->props.end())
+				{
+					if (mesh_in->skeleton.has_value())
 					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
-						acc.count = count;
-						acc.type = TINYGLTF_TYPE_VEC4;
-						m_out.accessors.push_back(acc);
+						prim.skel_path = mesh_in->skeleton.value().targetPath.full_path_name();
 					}
+					node_skin_map[node_id] = prim.skel_path;
+				}
+			}
 
-					prim_out.attributes["JOINTS_0"] = acc_id;
+			{
+				auto iter = mesh_in->props.find("skel:blendShapeTargets");
+				if (iter != mesh_in->props.end())
+				{
+					auto paths = iter->second.get_relationship().targetPathVector;
+					auto iter2 = mesh_in->props.find("skel:blendShapes");
+					auto names = iter2->second.get_attribute().get_value<std::vector<tinyusdz::Token>>().value();
 
-					offset = buf_out.data.size();
-					length = sizeof(glm::vec4) * count;
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, conv_jw_in.data(), length);
+					size_t num_morphs = paths.size();
+					target_counts[node_id] = (int)num_morphs;
 
-					view_id = m_out.bufferViews.size();
+					for (size_t i = 0; i < num_morphs; i++)
 					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						view.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-						m_out.bufferViews.push_back(view);
-					}
+						std::string name = names[i].str();
+						morph_map[name].push_back({ node_id, (int)i });
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = count;
-						acc.type = TINYGLTF_TYPE_VEC4;
-						m_out.accessors.push_back(acc);
+						const tinyusdz::Prim* primbs = stage.GetPrimAtPath(paths[i]).value();
+						job.blend_shapes.push_back(primbs->data().as<tinyusdz::BlendShape>());
 					}
-
-					prim_out.attributes["WEIGHTS_0"] = acc_id;
-
 				}
 			}
 
-			
-			prim_out.mode = TINYGLTF_MODE_TRIANGLES;
-			m_out.meshes.push_back(mesh_out);
-
+			m_out.meshes.emplace_back();
+			mesh_jobs.push_back(job);
 		}
-		else if (prim.prim->data().type_id() == tinyusdz::value::TYPE_ID_SKELETON)
+		else if (entry.type_id == tinyusdz::value::TYPE_ID_SKELETON)
 		{
 			int skin_idx = (int)m_out.skins.size();
 			m_out.skins.resize(skin_idx + 1);
@@ -1921,10 +2750,8 @@ USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
 
 			}
 
-			offset = buf_out.data.size();
 			length = sizeof(glm::mat4) * inv_binding_matrices.size();
-			buf_out.data.resize(offset + length);
-			memcpy(buf_out.data.data() + offset, inv_binding_matrices.data(), length);
+			offset = bin_out.Add(inv_binding_matrices.data(), length);
 
 			view_id = m_out.bufferViews.size();
 			{
@@ -1949,96 +2776,152 @@ USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
 			skin_out.inverseBindMatrices = acc_id;
 		}
 
-		if (prim.prim->data().type_id() != tinyusdz::value::TYPE_ID_MATERIAL
-			&& prim.prim->data().type_id() != tinyusdz::value::TYPE_ID_GEOM_MESH)
-		{			
-			size_t num_children = prim.prim->children().size();
-			for (size_t i = 0; i < num_children; i++)
+		node_base[idx_entry] = prim.id_node_base;
+	}
+	timer.Lap("nodes");
+
+	// Meshes are merged into the output in order as soon as they are done, so only the ones
+	// still in flight are held in memory.
+	std::vector<tinygltf::Model> mesh_parts(mesh_jobs.size());
+	std::vector<Mid::BufferPlan> mesh_plans(mesh_jobs.size());
+	std::vector<Mid::MeshInfo> mesh_infos(mesh_jobs.size());
+	std::map<std::string, Mid::QuantizeStat> quantize_stats;
+	size_t fallback_size = 0;
+	size_t meshopt_views = 0;
+	size_t meshopt_bytes_in = 0;
+	size_t meshopt_bytes_out = 0;
+	double meshopt_seconds = 0.0;
+	Mid::ThreadPool::Shared().ParallelForOrdered(mesh_jobs.size(), [&](size_t i)
+		{
+			usd2glb_mesh(mesh_jobs[i], options, mesh_parts[i], mesh_plans[i], mesh_infos[i]);
+		}, [&](size_t i)
+		{
+			const Mid::MeshInfo& info = mesh_infos[i];
+			if (options.report && info.cache_optimized)
+			{
+				printf("  mesh %s: %zu tris, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", mesh_parts[i].meshes[0].name.c_str(), info.num_tris,
+					info.cache_before.acmr, info.cache_after.acmr, info.cache_before.atvr, info.cache_after.atvr);
+			}
+			if (info.dequant_scale > 0.0f)
+			{
+				tinygltf::Node& node_out = m_out.nodes[mesh_jobs[i].node_id];
+				node_out.translation = { info.dequant_offset.x, info.dequant_offset.y, info.dequant_offset.z };
+				node_out.scale = { info.dequant_scale, info.dequant_scale, info.dequant_scale };
+			}
+			for (auto& iter : info.quantize_stats)
+			{
+				Mid::QuantizeStat& stat = quantize_stats[iter.first];
+				stat.bytes_float += iter.second.bytes_float;
+				stat.bytes_out += iter.second.bytes_out;
+				if (iter.second.max_error > stat.max_error) stat.max_error = iter.second.max_error;
+			}
+			meshopt_views += info.meshopt_views.size();
+			meshopt_bytes_in += info.meshopt_bytes_in;
+			meshopt_bytes_out += info.meshopt_bytes_out;
+			meshopt_seconds += info.meshopt_seconds;
+			usd2glb_merge_mesh(m_out, bin_out, mesh_parts[i], mesh_plans[i], info, &fallback_size, mesh_jobs[i].mesh_id);
+		}, options.num_threads);
+
+	// Point the weights channels built from morph_map at the targets that were kept.
+	size_t num_targets_dropped = 0;
+	{
+		std::unordered_map<int, const std::vector<int>*> node_target_remap;
+		for (size_t i = 0; i < mesh_jobs.size(); i++)
+		{
+			const std::vector<int>& target_remap = mesh_infos[i].target_remap;
+			if (target_remap.size() == 0) continue;
+			int num_kept = 0;
+			for (size_t j = 0; j < target_remap.size(); j++)
+			{
+				if (target_remap[j] >= 0) num_kept++;
+			}
+			num_targets_dropped += target_remap.size() - num_kept;
+			target_counts[mesh_jobs[i].node_id] = num_kept;
+			node_target_remap[mesh_jobs[i].node_id] = &target_remap;
+		}
+
+		auto iter = morph_map.begin();
+		while (iter != morph_map.end())
+		{
+			std::vector<MorphIdx>& targets = iter->second;
+			size_t num_kept = 0;
+			for (size_t j = 0; j < targets.size(); j++)
 			{
-				queue_prim.push({ &prim.prim->children()[i], prim.id_node_base, path, prim.idx_material, prim.skel_path });
+				MorphIdx target = targets[j];
+				auto iter_remap = node_target_remap.find(target.node_idx);
+				if (iter_remap != node_target_remap.end())
+				{
+					target.morph_idx = (*iter_remap->second)[target.morph_idx];
+					if (target.morph_idx < 0) continue;
+				}
+				targets[num_kept++] = target;
 			}
+			targets.resize(num_kept);
+			if (num_kept == 0) iter = morph_map.erase(iter);
+			else iter++;
+		}
+	}
+
+	if (quantize_stats.size() > 0)
+	{
+		m_out.extensionsUsed.push_back("KHR_mesh_quantization");
+		m_out.extensionsRequired.push_back("KHR_mesh_quantization");
+	}
+	if (meshopt_views > 0)
+	{
+		m_out.extensionsUsed.push_back("EXT_meshopt_compression");
+		if (!options.meshopt_fallback) m_out.extensionsRequired.push_back("EXT_meshopt_compression");
+	}
+	if (options.report && meshopt_views > 0)
+	{
+		printf("  meshopt %zu views %zu -> %zu bytes (ratio %.2f), encode %.1f MB/s per thread\n", meshopt_views, meshopt_bytes_in, meshopt_bytes_out,
+			(double)meshopt_bytes_in / (double)meshopt_bytes_out, meshopt_seconds > 0.0 ? meshopt_bytes_in / meshopt_seconds / 1e6 : 0.0);
+	}
+	if (options.report && num_targets_dropped > 0)
+	{
+		printf("  dropped %zu blend shapes that move nothing\n", num_targets_dropped);
+	}
+	if (options.report)
+	{
+		for (auto& iter : quantize_stats)
+		{
+			const Mid::QuantizeStat& stat = iter.second;
+			printf("  quantized %-14s %10zu -> %10zu bytes (%.1f%% saved), max error %g\n", iter.first.c_str(), stat.bytes_float, stat.bytes_out,
+				100.0 * (1.0 - (double)stat.bytes_out / (double)stat.bytes_float), stat.max_error);
 		}
 	}
+	timer.Lap("meshes");
 
-	std::vector<Mid::Image> tex_lst;	
+	std::vector<Mid::TextureJob> texture_jobs;
 
 	for (size_t i = 0; i < material_lst.size(); i++)
 	{
 		auto& material = material_lst[i];
 		if (material.diffuse_tex != "" || material.opacity_tex !="")
 		{
-			Mid::Image img_diffuse, img_opacity;
-			if (material.diffuse_tex != "")
-			{
-				img_diffuse.Load((path_model+ "/" + material.diffuse_tex).c_str());
-			}
-			if (material.opacity_tex != "")
-			{
-				img_opacity.Load((path_model + "/" + material.opacity_tex).c_str());
-			}
-
-			int idx = (int)tex_lst.size();
-			tex_lst.resize(idx + 1);
-
-			Mid::Image& img = tex_lst[idx];
-			img.CreateRGBA(img_diffuse, img_opacity);
-			material.idx_diffuse_alpha = idx;
+			material.idx_diffuse_alpha = (int)texture_jobs.size();
+			texture_jobs.push_back({ Mid::TextureJob::DIFFUSE_ALPHA, material.diffuse_tex, material.opacity_tex });
 		}
 		if (material.emissive_tex != "")
 		{
-			int idx = (int)tex_lst.size();
-			tex_lst.resize(idx + 1);
-
-			Mid::Image& img = tex_lst[idx];
-			img.Load((path_model + "/" + material.emissive_tex).c_str());
-			
-			material.idx_emissive = idx;
+			material.idx_emissive = (int)texture_jobs.size();
+			texture_jobs.push_back({ Mid::TextureJob::EMISSIVE, material.emissive_tex });
 		}
 
 		if (material.useSpecularWorkflow)
 		{
 			if (material.specular_tex != "" || material.roughness_tex != "")
 			{
-				Mid::Image img_specular, img_roughness;
-				if (material.specular_tex != "")
-				{
-					img_specular.Load((path_model + "/" + material.specular_tex).c_str());
-				}
-				if (material.roughness_tex != "")
-				{
-					img_roughness.Load((path_model + "/" + material.roughness_tex).c_str());
-				}
-
-				int idx = (int)tex_lst.size();
-				tex_lst.resize(idx + 1);
-
-				Mid::Image& img = tex_lst[idx];
-				img.CreateSG(img_specular, img_roughness, material.roughness);
-				material.idx_specular_glossiness = idx;
-
+				material.idx_specular_glossiness = (int)texture_jobs.size();
+				texture_jobs.push_back({ Mid::TextureJob::SPECULAR_GLOSSINESS, material.specular_tex, material.roughness_tex, material.roughness });
 			}
 		}
 		else
 		{
 			if (material.metallic_tex != "" || material.roughness_tex != "")
 			{
-				Mid::Image img_metallic, img_roughness;
-				if (material.metallic_tex != "")
-				{
-					img_metallic.Load((path_model + "/" + material.metallic_tex).c_str());
-				}
-				if (material.roughness_tex != "")
-				{
-					img_roughness.Load((path_model + "/" + material.roughness_tex).c_str());
-				}
-
-				int idx = (int)tex_lst.size();
-				tex_lst.resize(idx + 1);
-
-				Mid::Image& img = tex_lst[idx];
-				img.CreateMR(img_metallic, img_roughness);
-				material.idx_metallic_roughness = idx;
-
+				material.idx_metallic_roughness = (int)texture_jobs.size();
+				texture_jobs.push_back({ Mid::TextureJob::METALLIC_ROUGHNESS, material.metallic_tex, material.roughness_tex });
 			}
 		}
 	}
@@ -2048,39 +2931,45 @@ USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
 	sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR;
 	sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
 
+	std::vector<Mid::Image> tex_lst(texture_jobs.size());
 	m_out.images.resize(tex_lst.size());
 	m_out.textures.resize(tex_lst.size());
-	for (size_t i = 0; i < tex_lst.size(); i++)
-	{
-		Mid::Image& img_mid = tex_lst[i];
-		tinygltf::Image& img_out = m_out.images[i];
-		tinygltf::Texture& tex_out = m_out.textures[i];
+	Mid::ThreadPool::Shared().ParallelForOrdered(texture_jobs.size(), [&](size_t i)
+		{
+			usd2glb_texture(texture_jobs[i], resolver, tex_lst[i]);
+		}, [&](size_t i)
+		{
+			Mid::Image& img_mid = tex_lst[i];
+			tinygltf::Image& img_out = m_out.images[i];
+			tinygltf::Texture& tex_out = m_out.textures[i];
 
-		length = img_mid.code.size();
-		offset = buf_out.data.size();
-		buf_out.data.resize((offset + length + 3) / 4 * 4);
-		memcpy(buf_out.data.data() + offset, img_mid.code.data(), length);
+			size_t length = img_mid.code.size();
+			size_t offset = bin_out.Add(img_mid.code.data(), length);
 
-		img_out.width = img_mid.width;
-		img_out.height = img_mid.height;
-		img_out.component = 4;
-		img_out.bits = 8;
-		img_out.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
-		img_out.mimeType = img_mid.mimeType;
+			img_out.width = img_mid.width;
+			img_out.height = img_mid.height;
+			img_out.component = 4;
+			img_out.bits = 8;
+			img_out.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+			img_out.mimeType = img_mid.mimeType;
 
-		view_id = m_out.bufferViews.size();
-		{
-			tinygltf::BufferView view;
-			view.buffer = 0;
-			view.byteOffset = offset;
-			view.byteLength = length;
-			m_out.bufferViews.push_back(view);
-		}
-		img_out.bufferView = view_id;
+			size_t view_id = m_out.bufferViews.size();
+			{
+				tinygltf::BufferView view;
+				view.buffer = 0;
+				view.byteOffset = offset;
+				view.byteLength = length;
+				m_out.bufferViews.push_back(view);
+			}
+			img_out.bufferView = view_id;
 
-		tex_out.sampler = 0;
-		tex_out.source = i;
-	}
+			tex_out.sampler = 0;
+			tex_out.source = i;
+
+			img_mid = Mid::Image();
+		}, options.num_threads);
+
+	timer.Lap("textures");
 
 	m_out.materials.resize(material_lst.size());
 	for (size_t i = 0; i < material_lst.size(); i++)
@@ -2180,130 +3069,438 @@ USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
 		iter++;
 	}
 
-	queue_prim.push({ root_prim, -1, "" });
-	while (!queue_prim.empty())
-	{
-		Prim prim = queue_prim.front();
-		queue_prim.pop();
-		std::string path = prim.base_path + "/" + prim.prim->element_path().full_path_name();
+	float translation_error = options.reduce_translation_error > 0.0f ? options.reduce_translation_error : 1e-4f;
+	float rotation_error = glm::radians(options.reduce_rotation_error > 0.0f ? options.reduce_rotation_error : 0.01f);
+	float weight_error = options.reduce_weight_error > 0.0f ? options.reduce_weight_error : 1e-3f;
+	float rotation_quant_error = glm::radians(options.quantize_rotation_error > 0.0f ? options.quantize_rotation_error : 0.01f);
+	float weight_quant_error = options.quantize_weight_error > 0.0f ? options.quantize_weight_error : 1e-3f;
+
+	// Workers only read the maps built during traversal.
+	auto target_count = [&](int node_idx)
+	{
+		auto iter = target_counts.find(node_idx);
+		return iter != target_counts.end() ? (size_t)iter->second : (size_t)0;
+	};
+
+	// SkelAnimations are built concurrently, each spreading its joints over the pool too, into
+	// staged channels that are merged into the output in prim order as soon as they are done.
+	std::vector<Mid::StagedAnimation> staged_anims(prim_index.animations.size());
+	size_t time_bytes_shared = 0;
+	size_t num_keys_in = 0;
+	size_t num_keys_out = 0;
+	std::map<std::string, Mid::QuantizeStat> anim_quantize_stats;
+	Mid::ThreadPool::Shared().ParallelForOrdered(prim_index.animations.size(), [&](size_t i_anim)
+		{
+			const Mid::PrimIndex::Entry& entry = prim_index.entries[prim_index.animations[i_anim]];
+			Mid::StagedAnimation& staged = staged_anims[i_anim];
+
+			auto* anim_in = entry.prim->data().as<tinyusdz::SkelAnimation>();
+			staged.name = anim_in->name;
+
+			bool has_translations = anim_in->translations.get_value().has_value();
+			bool has_rotations = anim_in->rotations.get_value().has_value();
+			bool has_scales = anim_in->scales.get_value().has_value();
+
+			auto joints = anim_in->joints.get_value().value();
+
+			// Node of every joint, -1 for joints no skeleton has.
+			std::vector<int> joint_nodes(joints.size(), -1);
+			for (size_t i = 0; i < joints.size(); i++)
+			{
+				auto iter = joint_map.find(joints[i].str());
+				if (iter != joint_map.end()) joint_nodes[i] = iter->second;
+			}
+
+			Mid::JointTracks<glm::vec3> translations;
+			if (has_translations)
+			{
+				auto samples = anim_in->translations.get_value().value().get_timesamples().get_samples();
+				Mid::TransposeJointSamples(samples, joints.size(), time_codes_per_sec, glm::vec3(0.0f), [](const tinyusdz::value::float3& tran_in)
+					{
+						return glm::vec3(tran_in[0], tran_in[1], tran_in[2]);
+					}, translations);
+				has_translations = translations.times.size() > 0;
+			}
+
+			Mid::JointTracks<glm::quat> rotations;
+			if (has_rotations)
+			{
+				auto samples = anim_in->rotations.get_value().value().get_timesamples().get_samples();
+				Mid::TransposeJointSamples(samples, joints.size(), time_codes_per_sec, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), [](const tinyusdz::value::quatf& rot_in)
+					{
+						return glm::quat(rot_in.real, rot_in.imag[0], rot_in.imag[1], rot_in.imag[2]);
+					}, rotations);
+				has_rotations = rotations.times.size() > 0;
+			}
+
+			// With --resample every channel is evaluated on one timeline at a fixed rate, over the
+			// range of all the clip's samples.
+			std::vector<float> clip_times;
+			if (options.resample_fps > 0.0f)
+			{
+				float clip_begin = FLT_MAX;
+				float clip_end = -FLT_MAX;
+				if (has_translations)
+				{
+					clip_begin = glm::min(clip_begin, translations.times.front());
+					clip_end = glm::max(clip_end, translations.times.back());
+				}
+				if (has_rotations)
+				{
+					clip_begin = glm::min(clip_begin, rotations.times.front());
+					clip_end = glm::max(clip_end, rotations.times.back());
+				}
+				if (anim_in->blendShapes.get_value().has_value() && anim_in->blendShapeWeights.get_value().has_value())
+				{
+					auto samples = anim_in->blendShapeWeights.get_value().value().get_timesamples().get_samples();
+					if (samples.size() > 0)
+					{
+						clip_begin = glm::min(clip_begin, (float)(samples.front().t / time_codes_per_sec));
+						clip_end = glm::max(clip_end, (float)(samples.back().t / time_codes_per_sec));
+					}
+				}
+				if (clip_begin <= clip_end) clip_times = Mid::UniformTimes(clip_begin, clip_end, options.resample_fps);
+			}
+
+			// Keeping one timeline rules out dropping keys.
+			bool reduce_keys = options.reduce_keys && clip_times.size() == 0;
+
+			auto lerp_translation = [](const glm::vec3& a, const glm::vec3& b, float f)
+			{
+				return glm::mix(a, b, f);
+			};
+			auto lerp_rotation = [](const glm::quat& a, const glm::quat& b, float f)
+			{
+				return glm::slerp(a, b, f);
+			};
+
+			// Channels of every joint, resampled or reduced and encoded across joints in
+			// parallel: the translation at 2 * i, the rotation at 2 * i + 1.
+			std::vector<Mid::StagedChannel> joint_channels(joints.size() * 2);
+			Mid::ThreadPool::Shared().ParallelFor(joints.size(), [&](size_t i)
+				{
+					int id_node = joint_nodes[i];
+					if (id_node < 0) return;
+					const tinygltf::Node& node_rest = m_out.nodes[id_node];
+
+					if (has_translations)
+					{
+						const std::vector<float>* times = &translations.times;
+						const glm::vec3* values = translations.Track(i);
+						std::vector<glm::vec3> resampled;
+						if (clip_times.size() > 0)
+						{
+							Mid::ResampleTrack(translations.times, values, clip_times, lerp_translation, resampled);
+							times = &clip_times;
+							values = resampled.data();
+						}
+
+						glm::vec3 rest = glm::vec3(0.0f);
+						if (node_rest.translation.size() == 3) rest = glm::vec3((float)node_rest.translation[0], (float)node_rest.translation[1], (float)node_rest.translation[2]);
+						Mid::KeyTrack<glm::vec3> track;
+						usd2glb_joint_keys(*times, values, rest, reduce_keys, translation_error, lerp_translation, [](const glm::vec3& a, const glm::vec3& b)
+							{
+								return glm::length(a - b);
+							}, track);
+
+						if (track.times.size() > 0)
+						{
+							Mid::StagedChannel& channel = joint_channels[i * 2];
+							channel.node = id_node;
+							channel.path = "translation";
+							channel.step = track.step;
+							channel.times = std::move(track.times);
+							channel.type = TINYGLTF_TYPE_VEC3;
+							channel.count = track.values.size();
+							channel.output.resize(sizeof(glm::vec3) * channel.count);
+							memcpy(channel.output.data(), track.values.data(), channel.output.size());
+						}
+					}
+
+					if (has_rotations)
+					{
+						const std::vector<float>* times = &rotations.times;
+						const glm::quat* values = rotations.Track(i);
+						std::vector<glm::quat> resampled;
+						if (clip_times.size() > 0)
+						{
+							Mid::ResampleTrack(rotations.times, values, clip_times, lerp_rotation, resampled);
+							times = &clip_times;
+							values = resampled.data();
+						}
+
+						glm::quat rest = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+						if (node_rest.rotation.size() == 4) rest = glm::quat((float)node_rest.rotation[3], (float)node_rest.rotation[0], (float)node_rest.rotation[1], (float)node_rest.rotation[2]);
+						Mid::KeyTrack<glm::quat> track;
+						usd2glb_joint_keys(*times, values, rest, reduce_keys, rotation_error, lerp_rotation, usd2glb_quat_angle, track);
+
+						// Before quantizing, keep consecutive keys in the same hemisphere, so viewers
+						// that interpolate the components don't take the long way round.
+						std::vector<glm::quat>& rots = track.values;
+						for (size_t k = 1; options.quantize && k < rots.size(); k++)
+						{
+							if (glm::dot(rots[k - 1], rots[k]) < 0.0f) rots[k] = glm::quat(-rots[k].w, -rots[k].x, -rots[k].y, -rots[k].z);
+						}
+
+						if (track.times.size() > 0)
+						{
+							Mid::StagedChannel& channel = joint_channels[i * 2 + 1];
+							channel.node = id_node;
+							channel.path = "rotation";
+							channel.step = track.step;
+							channel.times = std::move(track.times);
+							channel.type = TINYGLTF_TYPE_VEC4;
+							channel.count = rots.size();
+							if (options.quantize) channel.component_type = usd2glb_rotation_type(rots.data(), rots.size(), rotation_quant_error, &channel.quantize_error);
+
+							std::vector<float> rot_out(4 * rots.size());
+							for (size_t k = 0; k < rots.size(); k++)
+							{
+								float* p_out = rot_out.data() + k * 4;
+								glm::quat rot = rots[k];
+								p_out[0] = rot.x;
+								p_out[1] = rot.y;
+								p_out[2] = rot.z;
+								p_out[3] = rot.w;
+							}
+							channel.output.resize(tinygltf::GetComponentSizeInBytes(channel.component_type) * rot_out.size());
+							usd2glb_write_components(rot_out.data(), rot_out.size(), channel.component_type, channel.output.data());
+						}
+					}
+
+#if 0
+					if (has_scales)
+					{
+						auto scales = anim_in->scales.GetValue().value().ts.GetSamples();
+
+						int id_channel = (int)anim_out.channels.size();
+						anim_out.channels.resize(id_channel + 1);
+						tinygltf::AnimationChannel& channel = anim_out.channels[id_channel];
+						channel.target_node = id_node;
+						channel.target_path = "scale";
+
+						int id_sampler = (int)anim_out.samplers.size();
+						channel.sampler = id_sampler;
+
+						anim_out.samplers.resize(id_sampler + 1);
+						tinygltf::AnimationSampler& sampler = anim_out.samplers[id_sampler];
+
+						std::vector<float> times(scales.size());
+						std::vector<glm::vec3> values(scales.size());
+
+						for (size_t j = 0; j < scales.size(); j++)
+						{
+							times[j] = (float)(scales[j].t / time_codes_per_sec);
+							auto scale_in = scales[j].value[i];
+							values[j] = glm::vec3(half_to_float(scale_in[0]), half_to_float(scale_in[1]), half_to_float(scale_in[2]));
+						}
+
+						sampler.input = usd2glb_time_accessor(times.data(), times.size(), time_accessors, m_out, bin_out, &time_bytes_shared);
 
-		if (prim.prim->data().type_id() == tinyusdz::value::TYPE_ID_SKELANIMATION)
-		{
-			auto* anim_in = prim.prim->data().as<tinyusdz::SkelAnimation>();
-			int id_anim = (int)m_out.animations.size();
-			m_out.animations.resize(id_anim + 1);
+						length = sizeof(glm::vec3) * values.size();
+						offset = bin_out.Add(values.data(), length);
 
-			tinygltf::Animation& anim_out = m_out.animations[id_anim];
-			anim_out.name = anim_in->name;
+						view_id = m_out.bufferViews.size();
+						{
+							tinygltf::BufferView view;
+							view.buffer = 0;
+							view.byteOffset = offset;
+							view.byteLength = length;
+							m_out.bufferViews.push_back(view);
+						}
 
-			bool has_translations = anim_in->translations.get_value().has_value();
-			bool has_rotations = anim_in->rotations.get_value().has_value();
-			bool has_scales = anim_in->scales.get_value().has_value();
+						acc_id = m_out.accessors.size();
+						{
+							tinygltf::Accessor acc;
+							acc.bufferView = view_id;
+							acc.byteOffset = 0;
+							acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+							acc.count = values.size();
+							acc.type = TINYGLTF_TYPE_VEC3;
+							m_out.accessors.push_back(acc);
+						}
+
+						sampler.output = acc_id;
+					}
+
+#endif			
+				}, options.num_threads);
 
-			auto joints = anim_in->joints.get_value().value();
 			for (size_t i = 0; i < joints.size(); i++)
 			{
-				std::string joint_path = joints[i].str();
-				auto iter = joint_map.find(joint_path);
-				if (iter == joint_map.end()) continue;
-				int id_node = joint_map[joint_path];
-
-				if (has_translations)
+				if (joint_nodes[i] < 0) continue;
+				if (has_translations) staged.num_keys_in += translations.times.size();
+				if (has_rotations) staged.num_keys_in += rotations.times.size();
+				for (size_t k = i * 2; k < i * 2 + 2; k++)
 				{
-					auto translations = anim_in->translations.get_value().value().get_timesamples().get_samples();
+					if (joint_channels[k].node < 0) continue;
+					staged.num_keys_out += joint_channels[k].times.size();
+					staged.channels.push_back(std::move(joint_channels[k]));
+				}
+			}
 
-					int id_channel = (int)anim_out.channels.size();
-					anim_out.channels.resize(id_channel + 1);
-					tinygltf::AnimationChannel& channel = anim_out.channels[id_channel];
-					channel.target_node = id_node;
-					channel.target_path = "translation";
+			if (anim_in->blendShapes.get_value().has_value())
+			{
+				auto bs_names = anim_in->blendShapes.get_value().value();
+				std::vector<std::vector<MorphIdx>> morphIdx(bs_names.size());
+				for (size_t i = 0; i < bs_names.size(); i++)
+				{
+					auto iter = morph_map.find(bs_names[i].str());
+					if (iter != morph_map.end())
+					{
+						morphIdx[i] = iter->second;
+					}
+				}
 
-					int id_sampler = (int)anim_out.samplers.size();
-					channel.sampler = id_sampler;
+				struct MorphChannel
+				{
+					std::vector<float> times;
+					std::vector<float> weights;
+					bool step = false;
+				};
 
-					anim_out.samplers.resize(id_sampler + 1);
-					tinygltf::AnimationSampler& sampler = anim_out.samplers[id_sampler];
+				// By node, so the channels come out in the same order on every run.
+				std::map<int, MorphChannel> mchans;
 
-					std::vector<float> times(translations.size());
-					std::vector<glm::vec3> values(translations.size());
+				auto weights = anim_in->blendShapeWeights.get_value().value().get_timesamples().get_samples();
+				size_t num_time_samples = weights.size();
 
-					for (size_t j = 0; j < translations.size(); j++)
+				for (size_t i = 0; i < morphIdx.size(); i++)
+				{
+					auto targets = morphIdx[i];
+					for (size_t j = 0; j < targets.size(); j++)
 					{
-						times[j] = (float)(translations[j].t / time_codes_per_sec);
-						auto tran_in = translations[j].value[i];
-						values[j] = glm::vec3(tran_in[0], tran_in[1], tran_in[2]);
+						auto target = targets[j];
+						auto iter = mchans.find(target.node_idx);
+						if (iter == mchans.end())
+						{
+							size_t num_targets = target_count(target.node_idx);
+							mchans[target.node_idx] = { std::vector<float>(num_time_samples),std::vector<float>(num_time_samples* num_targets), false };
+						}
 					}
+				}
 
-					float t0 = times[0];
-					float t1 = times[times.size() - 1];
-
-					offset = buf_out.data.size();
-					length = sizeof(float) * times.size();
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, times.data(), length);
-
-					view_id = m_out.bufferViews.size();
+				for (size_t i = 0; i < weights.size(); i++)
+				{
+					float t = (float)(weights[i].t/ time_codes_per_sec);
+					auto v = weights[i].value;
+					for (size_t j = 0; j < v.size(); j++)
 					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						m_out.bufferViews.push_back(view);
+						float w = v[j];
+						auto targets = morphIdx[j];
+						for (size_t k = 0; k < targets.size(); k++)
+						{
+							auto target = targets[k];
+							auto& mchan = mchans[target.node_idx];
+							size_t num_targets = target_count(target.node_idx);
+							mchan.times[i] = t;
+							mchan.weights[i * num_targets + target.morph_idx] = w;
+						}
 					}
+				}
 
-					acc_id = m_out.accessors.size();
+				auto iter = mchans.begin();
+				while (iter != mchans.end())
+				{
+					MorphChannel& mchan = iter->second;
+					size_t num_targets = target_count(iter->first);
+					staged.num_keys_in += mchan.times.size();
+					if (clip_times.size() > 0)
 					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = times.size();
-						acc.type = TINYGLTF_TYPE_SCALAR;
-						acc.minValues = { t0 };
-						acc.maxValues = { t1 };
-						m_out.accessors.push_back(acc);
+						std::vector<float> resampled(clip_times.size() * num_targets);
+						const float* w = mchan.weights.data();
+						Mid::ResampleKeys(mchan.times, clip_times, [&](size_t k, size_t a, size_t b, float f)
+							{
+								for (size_t j = 0; j < num_targets; j++)
+								{
+									resampled[k * num_targets + j] = w[a * num_targets + j] * (1.0f - f) + w[b * num_targets + j] * f;
+								}
+							});
+						mchan.times = clip_times;
+						mchan.weights.swap(resampled);
 					}
-
-					sampler.input = acc_id;
-
-					offset = buf_out.data.size();
-					length = sizeof(glm::vec3) * values.size();
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, values.data(), length);
-
-					view_id = m_out.bufferViews.size();
+					if (reduce_keys && num_targets > 0)
 					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						m_out.bufferViews.push_back(view);
+						const float* w = mchan.weights.data();
+						std::vector<size_t> keys;
+						usd2glb_reduce_keys(mchan.times.data(), mchan.times.size(), [&](size_t i, size_t j)
+							{
+								for (size_t k = 0; k < num_targets; k++)
+								{
+									if (fabsf(w[i * num_targets + k] - w[j * num_targets + k]) > weight_error) return false;
+								}
+								return true;
+							}, [&](size_t a, size_t b, size_t i, float f)
+							{
+								for (size_t k = 0; k < num_targets; k++)
+								{
+									float lerp = w[a * num_targets + k] * (1.0f - f) + w[b * num_targets + k] * f;
+									if (fabsf(lerp - w[i * num_targets + k]) > weight_error) return false;
+								}
+								return true;
+							}, [&](size_t i)
+							{
+								for (size_t k = 0; k < num_targets; k++)
+								{
+									if (fabsf(w[i * num_targets + k]) > weight_error) return false;
+								}
+								return true;
+							}, keys, &mchan.step);
+
+						MorphChannel reduced;
+						reduced.step = mchan.step;
+						reduced.times.resize(keys.size());
+						reduced.weights.resize(keys.size() * num_targets);
+						for (size_t k = 0; k < keys.size(); k++)
+						{
+							reduced.times[k] = mchan.times[keys[k]];
+							memcpy(&reduced.weights[k * num_targets], &w[keys[k] * num_targets], sizeof(float) * num_targets);
+						}
+						mchan = std::move(reduced);
 					}
+					staged.num_keys_out += mchan.times.size();
 
-					acc_id = m_out.accessors.size();
+					if (mchan.times.size() > 0)
 					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = values.size();
-						acc.type = TINYGLTF_TYPE_VEC3;
-						m_out.accessors.push_back(acc);
+						Mid::StagedChannel channel;
+						channel.node = iter->first;
+						channel.path = "weights";
+						channel.step = mchan.step;
+						channel.times = std::move(mchan.times);
+						channel.count = mchan.weights.size();
+						if (options.quantize) channel.component_type = usd2glb_weight_type(mchan.weights.data(), mchan.weights.size(), weight_quant_error, &channel.quantize_error);
+						channel.output.resize(tinygltf::GetComponentSizeInBytes(channel.component_type) * mchan.weights.size());
+						usd2glb_write_components(mchan.weights.data(), mchan.weights.size(), channel.component_type, channel.output.data());
+						staged.channels.push_back(std::move(channel));
 					}
+					iter++;
+				}
+			}
+		}, [&](size_t i_anim)
+		{
+			Mid::StagedAnimation& staged = staged_anims[i_anim];
+			num_keys_in += staged.num_keys_in;
+			num_keys_out += staged.num_keys_out;
 
-					sampler.output = acc_id;
+			// Every channel may have been dropped as staying at the rest pose.
+			if (staged.channels.size() > 0)
+			{
+				int id_anim = (int)m_out.animations.size();
+				m_out.animations.resize(id_anim + 1);
 
-				}
+				tinygltf::Animation& anim_out = m_out.animations[id_anim];
+				anim_out.name = staged.name;
 
-				if (has_rotations)
+				Mid::TimeAccessorCache time_accessors;
+				for (size_t j = 0; j < staged.channels.size(); j++)
 				{
-					auto rotations = anim_in->rotations.get_value().value().get_timesamples().get_samples();
+					const Mid::StagedChannel& channel_in = staged.channels[j];
 
 					int id_channel = (int)anim_out.channels.size();
 					anim_out.channels.resize(id_channel + 1);
 					tinygltf::AnimationChannel& channel = anim_out.channels[id_channel];
-					channel.target_node = id_node;
-					channel.target_path = "rotation";
+					channel.target_node = channel_in.node;
+					channel.target_path = channel_in.path;
 
 					int id_sampler = (int)anim_out.samplers.size();
 					channel.sampler = id_sampler;
@@ -2311,25 +3508,13 @@ USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
 					anim_out.samplers.resize(id_sampler + 1);
 					tinygltf::AnimationSampler& sampler = anim_out.samplers[id_sampler];
 
-					std::vector<float> times(rotations.size());
-					std::vector<glm::quat> values(rotations.size());
-
-					for (size_t j = 0; j < rotations.size(); j++)
-					{
-						times[j] = (float)(rotations[j].t / time_codes_per_sec);
-						auto rot_in = rotations[j].value[i];
-						values[j] = glm::quat(rot_in.real, rot_in.imag[0], rot_in.imag[1], rot_in.imag[2]);
-					}
-
-					float t0 = times[0];
-					float t1 = times[times.size() - 1];
+					if (channel_in.step) sampler.interpolation = "STEP";
+					sampler.input = usd2glb_time_accessor(channel_in.times.data(), channel_in.times.size(), time_accessors, m_out, bin_out, &time_bytes_shared);
 
-					offset = buf_out.data.size();
-					length = sizeof(float) * times.size();
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, times.data(), length);
+					size_t length = channel_in.output.size();
+					size_t offset = bin_out.Add(channel_in.output.data(), length);
 
-					view_id = m_out.bufferViews.size();
+					int view_id = (int)m_out.bufferViews.size();
 					{
 						tinygltf::BufferView view;
 						view.buffer = 0;
@@ -2338,324 +3523,674 @@ USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
 						m_out.bufferViews.push_back(view);
 					}
 
-					acc_id = m_out.accessors.size();
+					int acc_id = (int)m_out.accessors.size();
 					{
 						tinygltf::Accessor acc;
 						acc.bufferView = view_id;
 						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = times.size();
-						acc.type = TINYGLTF_TYPE_SCALAR;
-						acc.minValues = { t0 };
-						acc.maxValues = { t1 };
+						acc.componentType = channel_in.component_type;
+						acc.normalized = channel_in.component_type != TINYGLTF_COMPONENT_TYPE_FLOAT;
+						acc.count = channel_in.count;
+						acc.type = channel_in.type;
 						m_out.accessors.push_back(acc);
 					}
-					sampler.input = acc_id;
 
-					offset = buf_out.data.size();
-					length = sizeof(float) * 4 * values.size();
-					buf_out.data.resize(offset + length);
-					for (size_t k = 0; k < values.size(); k++)
-					{
-						float* p_out = (float*)(buf_out.data.data() + offset) + k * 4;
-						glm::quat rot = values[k];
-						p_out[0] = rot.x;
-						p_out[1] = rot.y;
-						p_out[2] = rot.z;
-						p_out[3] = rot.w;
-					}
+					sampler.output = acc_id;
 
-					view_id = m_out.bufferViews.size();
+					if (options.quantize && strcmp(channel_in.path, "translation") != 0)
 					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						m_out.bufferViews.push_back(view);
+						Mid::QuantizeStat& stat = anim_quantize_stats[channel_in.path];
+						stat.bytes_float += sizeof(float) * tinygltf::GetNumComponentsInType(channel_in.type) * channel_in.count;
+						stat.bytes_out += length;
+						if (channel_in.quantize_error > stat.max_error) stat.max_error = channel_in.quantize_error;
 					}
+				}
+			}
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = values.size();
-						acc.type = TINYGLTF_TYPE_VEC4;
-						m_out.accessors.push_back(acc);
-					}
+			staged = Mid::StagedAnimation();
+		}, options.num_threads);
+	if (options.report && options.reduce_keys)
+	{
+		printf("  reduced keys %zu -> %zu\n", num_keys_in, num_keys_out);
+	}
+	if (options.report)
+	{
+		for (auto& iter : anim_quantize_stats)
+		{
+			const Mid::QuantizeStat& stat = iter.second;
+			printf("  quantized anim %-9s %10zu -> %10zu bytes (%.1f%% saved), max error %g\n", iter.first.c_str(), stat.bytes_float, stat.bytes_out,
+				100.0 * (1.0 - (double)stat.bytes_out / (double)stat.bytes_float), stat.max_error);
+		}
+	}
+	if (options.report && time_bytes_shared > 0)
+	{
+		printf("  shared keyframe times saved %zu bytes\n", time_bytes_shared);
+	}
 
-					sampler.output = acc_id;
+	timer.Lap("animations");
 
-				}
+	return 0;
+}
 
-#if 0
-				if (has_scales)
-				{
-					auto scales = anim_in->scales.GetValue().value().ts.GetSamples();
+static tinyusdz::USDLoadOptions usd2glb_load_options()
+{
+	tinyusdz::USDLoadOptions options;
+	options.max_image_width = options.max_image_height = 4096;
+	options.load_assets = false;
+	return options;
+}
 
-					int id_channel = (int)anim_out.channels.size();
-					anim_out.channels.resize(id_channel + 1);
-					tinygltf::AnimationChannel& channel = anim_out.channels[id_channel];
-					channel.target_node = id_node;
-					channel.target_path = "scale";
+// Serializes everything but the buffer data, which the writer holds or has already streamed,
+// into the JSON chunk.
+static int usd2glb_json(tinygltf::Model& m_out, const Mid::GlbWriter& bin_out, std::string& json)
+{
+	m_out.buffers.clear();
 
-					int id_sampler = (int)anim_out.samplers.size();
-					channel.sampler = id_sampler;
+	std::ostringstream stream;
+	tinygltf::TinyGLTF gltf;
+	bool writeGltfSuccess = gltf.WriteGltfSceneToStream(&m_out, stream, false, false);
+	if (writeGltfSuccess == false)
+	{
+		return -2;
+	}
+
+	json = stream.str();
+	size_t pos = json.find_last_of('}');
+	if (pos == std::string::npos)
+	{
+		return -2;
+	}
+	// Buffer 1 is the EXT_meshopt_compression fallback buffer, only referenced by the views
+	// whose data exists just in compressed form.
+	size_t fallback_size = 0;
+	for (size_t i = 0; i < m_out.bufferViews.size(); i++)
+	{
+		const tinygltf::BufferView& view = m_out.bufferViews[i];
+		if (view.buffer == 1 && view.byteOffset + view.byteLength > fallback_size) fallback_size = view.byteOffset + view.byteLength;
+	}
+
+	json.resize(pos);
+	json += ",\"buffers\":[{\"byteLength\":" + std::to_string(bin_out.Size()) + "}";
+	if (fallback_size > 0)
+	{
+		json += ",{\"byteLength\":" + std::to_string(fallback_size) + ",\"extensions\":{\"EXT_meshopt_compression\":{\"fallback\":true}}}";
+	}
+	json += "]}";
+	return 0;
+}
+
+// Finishes the glb with the JSON of m_out.
+static int usd2glb_finish(tinygltf::Model& m_out, Mid::GlbWriter& bin_out)
+{
+	std::string json;
+	int status = usd2glb_json(m_out, bin_out, json);
+	if (status != 0)
+	{
+		return status;
+	}
+	if (!bin_out.Finish(json))
+	{
+		return -2;
+	}
+	return 0;
+}
+
+static int usd2glb_memory_to_memory(const unsigned char* usdData, size_t usdSize, const Mid::TextureResolver& resolver, const usd2glb_options& options, unsigned char** glb, size_t* glb_size)
+{
+	std::string warn;
+	std::string err;
+
+	tinyusdz::Stage stage;
+	bool ret = tinyusdz::LoadUSDFromMemory(usdData, usdSize, "", &stage, &warn, &err, usd2glb_load_options());
+	if (!ret)
+	{
+		printf("%s\n", warn.c_str());
+		printf("%s\n", err.c_str());
+		return -1;
+	}
+
+	Mid::GlbWriter bin_out;
+	bin_out.num_threads = options.num_threads;
+	bin_out.OpenMemory();
+
+	tinygltf::Model m_out;
+	usd2glb_stage(stage, resolver, options, m_out, bin_out);
+
+	int status = usd2glb_finish(m_out, bin_out);
+	if (status == 0)
+	{
+		*glb = bin_out.Release(glb_size);
+	}
+	return status;
+}
+
+USD2GLB_API void usd2glb_options_init(usd2glb_options* options)
+{
+	memset(options, 0, sizeof(usd2glb_options));
+}
+
+USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput)
+{
+	return usd2glb_ex(usdPathInput, glbPathOutput, nullptr);
+}
+
+USD2GLB_API int usd2glb_ex(const char* usdPathInput, const char* glbPathOutput, const usd2glb_options* pOptions)
+{
+	usd2glb_options options;
+	usd2glb_options_init(&options);
+	if (pOptions != nullptr) options = *pOptions;
+
+	std::string warn;
+	std::string err;
+
+	tinyusdz::Stage stage;
+	bool ret = tinyusdz::LoadUSDFromFile(usdPathInput, &stage, &warn, &err, usd2glb_load_options());
+	if (!ret)
+	{
+		printf("%s\n", warn.c_str());
+		printf("%s\n", err.c_str());
+		return -1;
+	}
+
+	Mid::TextureResolver resolver;
+	resolver.base_dir = std::filesystem::path(usdPathInput).parent_path().u8string();
+
+	Mid::GlbWriter bin_out;
+	bin_out.num_threads = options.num_threads;
+	if (!bin_out.Open(glbPathOutput))
+	{
+		return -2;
+	}
+
+	tinygltf::Model m_out;
+	usd2glb_stage(stage, resolver, options, m_out, bin_out);
+
+	return usd2glb_finish(m_out, bin_out);
+}
+
+USD2GLB_API int usd2glb_from_memory(const unsigned char* usdData, size_t usdSize, usd2glb_resolve_fn resolve, void* userData, unsigned char** glbData, size_t* glbSize)
+{
+	return usd2glb_from_memory_ex(usdData, usdSize, resolve, userData, glbData, glbSize, nullptr);
+}
+
+USD2GLB_API int usd2glb_from_memory_ex(const unsigned char* usdData, size_t usdSize, usd2glb_resolve_fn resolve, void* userData, unsigned char** glbData, size_t* glbSize, const usd2glb_options* pOptions)
+{
+	usd2glb_options options;
+	usd2glb_options_init(&options);
+	if (pOptions != nullptr) options = *pOptions;
+
+	Mid::TextureResolver resolver;
+	resolver.resolve = resolve;
+	resolver.user_data = userData;
+
+	return usd2glb_memory_to_memory(usdData, usdSize, resolver, options, glbData, glbSize);
+}
+
+USD2GLB_API void usd2glb_free(unsigned char* glbData)
+{
+	free(glbData);
+}
+
+USD2GLB_API int usd2glb_batch(const char* manifestPath, int numThreads)
+{
+	return usd2glb_batch_ex(manifestPath, numThreads, nullptr);
+}
+
+USD2GLB_API int usd2glb_batch_ex(const char* manifestPath, int numThreads, const usd2glb_options* options)
+{
+	struct Job
+	{
+		std::string input;
+		std::string output;
+	};
+
+	std::vector<Job> jobs;
+	{
+		std::ifstream manifest(manifestPath);
+		if (!manifest)
+		{
+			printf("can't open manifest %s\n", manifestPath);
+			return -1;
+		}
+
+		std::string line;
+		while (std::getline(manifest, line))
+		{
+			if (line.size() > 0 && line.back() == '\r') line.pop_back();
+			if (line.empty() || line[0] == '#') continue;
 
-					anim_out.samplers.resize(id_sampler + 1);
-					tinygltf::AnimationSampler& sampler = anim_out.samplers[id_sampler];
+			size_t pos = line.find('\t');
+			if (pos == std::string::npos) pos = line.find(' ');
+			if (pos == std::string::npos)
+			{
+				printf("skipping manifest line without output: %s\n", line.c_str());
+				continue;
+			}
+			size_t pos_out = line.find_first_not_of(" \t", pos);
+			if (pos_out == std::string::npos) continue;
+			jobs.push_back({ line.substr(0, pos), line.substr(pos_out) });
+		}
+	}
 
-					std::vector<float> times(scales.size());
-					std::vector<glm::vec3> values(scales.size());
+	std::mutex mutex_report;
+	std::atomic<int> num_failed{ 0 };
 
-					for (size_t j = 0; j < scales.size(); j++)
-					{
-						times[j] = (float)(scales[j].t / time_codes_per_sec);
-						auto scale_in = scales[j].value[i];
-						values[j] = glm::vec3(half_to_float(scale_in[0]), half_to_float(scale_in[1]), half_to_float(scale_in[2]));
-					}
+	auto t_start = std::chrono::steady_clock::now();
 
-					float t0 = times[0];
-					float t1 = times[times.size() - 1];
+	Mid::ThreadPool pool(numThreads > 0 ? (unsigned)numThreads : 0);
+	pool.ParallelFor(jobs.size(), [&](size_t i)
+		{
+			const Job& job = jobs[i];
+			auto t0 = std::chrono::steady_clock::now();
+			int ret = usd2glb_ex(job.input.c_str(), job.output.c_str(), options);
+			auto t1 = std::chrono::steady_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
 
-					offset = buf_out.data.size();
-					length = sizeof(float) * times.size();
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, times.data(), length);
+			if (ret != 0) num_failed++;
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						m_out.bufferViews.push_back(view);
-					}
+			std::unique_lock<std::mutex> lock(mutex_report);
+			printf("%s %d %.1fms %s -> %s\n", ret == 0 ? "ok" : "failed", ret, ms, job.input.c_str(), job.output.c_str());
+		});
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = times.size();
-						acc.type = TINYGLTF_TYPE_SCALAR;
-						acc.minValues = { t0 };
-						acc.maxValues = { t1 };
-						m_out.accessors.push_back(acc);
-					}
+	auto t_end = std::chrono::steady_clock::now();
+	double total_ms = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+	printf("%d/%d converted in %.1fms using %u threads\n", (int)jobs.size() - num_failed.load(), (int)jobs.size(), total_ms, pool.Size());
 
-					sampler.input = acc_id;
+	return num_failed.load();
+}
 
-					offset = buf_out.data.size();
-					length = sizeof(glm::vec3) * values.size();
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, values.data(), length);
+#ifndef _WIN32
+static bool read_full(int fd, void* data, size_t size)
+{
+	uint8_t* p = (uint8_t*)data;
+	while (size > 0)
+	{
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						m_out.bufferViews.push_back(view);
-					}
+static bool write_full(int fd, const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	while (size > 0)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = values.size();
-						acc.type = TINYGLTF_TYPE_VEC3;
-						m_out.accessors.push_back(acc);
-					}
+static bool read_string(int fd, std::string& str)
+{
+	uint32_t len;
+	if (!read_full(fd, &len, sizeof(len))) return false;
+	if (len > (1u << 16)) return false;
+	str.resize(len);
+	return read_full(fd, &str[0], len);
+}
 
-					sampler.output = acc_id;
-				}
+// Converts stage and answers the job on fd. The status and size go out once the JSON is
+// known, then the glb is written straight from the buffer plan, freeing each region as it
+// is sent, so the output is never assembled in memory. *replied tells whether anything was
+// sent; a failure after that leaves the connection unusable.
+static int usd2glb_stage_to_fd(tinyusdz::Stage& stage, const Mid::TextureResolver& resolver, const usd2glb_options& options, int fd, bool* replied)
+{
+	*replied = false;
 
-#endif			
-			}
-			
-			if (anim_in->blendShapes.get_value().has_value())
-			{
-				auto bs_names = anim_in->blendShapes.get_value().value();
-				std::vector<std::vector<MorphIdx>> morphIdx(bs_names.size());
-				for (size_t i = 0; i < bs_names.size(); i++)
-				{
-					auto iter = morph_map.find(bs_names[i].str());
-					if (iter != morph_map.end())
-					{
-						morphIdx[i] = iter->second;
-					}
-				}
+	Mid::GlbWriter bin_out;
+	bin_out.num_threads = options.num_threads;
+	if (!bin_out.OpenFd(fd))
+	{
+		return -2;
+	}
 
-				struct MorphChannel
-				{
-					std::vector<float> times;
-					std::vector<float> weights;
-				};
+	tinygltf::Model m_out;
+	usd2glb_stage(stage, resolver, options, m_out, bin_out);
 
-				std::unordered_map<int, MorphChannel> mchans;
+	std::string json;
+	int32_t status = usd2glb_json(m_out, bin_out, json);
+	if (status != 0)
+	{
+		return status;
+	}
+	uint64_t size = bin_out.GlbSize(json);
+	if (size > 0xffffffffull)
+	{
+		return -2;
+	}
 
-				auto weights = anim_in->blendShapeWeights.get_value().value().get_timesamples().get_samples();
-				size_t num_time_samples = weights.size();
+	*replied = true;
+	if (!write_full(fd, &status, sizeof(status)) || !write_full(fd, &size, sizeof(size)) || !bin_out.Finish(json))
+	{
+		return -2;
+	}
+	return 0;
+}
 
-				for (size_t i = 0; i < morphIdx.size(); i++)
+static void usd2glb_serve_connection(int fd, Mid::ImageCache& cache, const usd2glb_options& options)
+{
+	// The input buffer stays with the worker thread so repeated jobs reuse its capacity, up
+	// to keep_input; a larger one is released after its job instead of staying pinned.
+	thread_local std::vector<unsigned char> usd;
+	const size_t keep_input = (size_t)64 << 20;
+	uint64_t max_input = (uint64_t)(options.daemon_max_input_mb > 0 ? options.daemon_max_input_mb : 1024) << 20;
+
+	// A client that stalls mid-job gives its worker back instead of holding it forever.
+	timeval timeout = { 60, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	while (true)
+	{
+		char cmd[4];
+		if (!read_full(fd, cmd, sizeof(cmd))) break;
+
+		auto t0 = std::chrono::steady_clock::now();
+		std::string input;
+		std::string warn;
+		std::string err;
+		tinyusdz::Stage stage;
+		Mid::TextureResolver resolver;
+		resolver.cache = &cache;
+		bool loaded = false;
+
+		if (memcmp(cmd, "PATH", 4) == 0)
+		{
+			if (!read_string(fd, input)) break;
+			resolver.base_dir = std::filesystem::path(input).parent_path().u8string();
+			loaded = tinyusdz::LoadUSDFromFile(input.c_str(), &stage, &warn, &err, usd2glb_load_options());
+		}
+		else if (memcmp(cmd, "DATA", 4) == 0)
+		{
+			if (!read_string(fd, resolver.base_dir)) break;
+
+			uint64_t size;
+			if (!read_full(fd, &size, sizeof(size))) break;
+			// The payload isn't read past the limit: the client is told and the connection
+			// closed, since the rest of its stream can't be skipped cheaply.
+			bool fits = size <= max_input;
+			if (fits)
+			{
+				try
 				{
-					auto targets = morphIdx[i];
-					for (size_t j = 0; j < targets.size(); j++)
-					{
-						auto target = targets[j];
-						auto iter = mchans.find(target.node_idx);
-						if (iter == mchans.end())
-						{
-							int num_targets = target_counts[target.node_idx];
-							mchans[target.node_idx] = { std::vector<float>(num_time_samples),std::vector<float>(num_time_samples* num_targets)};
-						}
-					}
+					usd.resize((size_t)size);
 				}
-
-				
-				for (size_t i = 0; i < weights.size(); i++)
+				catch (const std::bad_alloc&)
 				{
-					float t = (float)(weights[i].t/ time_codes_per_sec);
-					auto v = weights[i].value;
-					for (size_t j = 0; j < v.size(); j++)
-					{
-						float w = v[j];
-						auto targets = morphIdx[j];
-						for (size_t k = 0; k < targets.size(); k++)
-						{
-							auto target = targets[k];
-							auto& mchan = mchans[target.node_idx];
-							int num_targets = target_counts[target.node_idx];
-							mchan.times[i] = t;
-							mchan.weights[i * num_targets + target.morph_idx] = w;
-						}
-					}
+					fits = false;
 				}
+			}
+			if (!fits)
+			{
+				int32_t rejected = -3;
+				uint64_t no_size = 0;
+				if (write_full(fd, &rejected, sizeof(rejected))) write_full(fd, &no_size, sizeof(no_size));
+				printf("failed %d <%llu bytes>\n", rejected, (unsigned long long)size);
+				break;
+			}
+			if (!read_full(fd, usd.data(), usd.size())) break;
 
-				int id_channel = (int)anim_out.channels.size();
-				anim_out.channels.resize(id_channel + mchans.size());
-				
-				auto iter = mchans.begin();
-				while (iter != mchans.end())
-				{
-					tinygltf::AnimationChannel& channel = anim_out.channels[id_channel];
-					int id_node = iter->first;
-					MorphChannel& mchan = iter->second;
+			input = "<" + std::to_string(size) + " bytes>";
+			loaded = tinyusdz::LoadUSDFromMemory(usd.data(), usd.size(), "", &stage, &warn, &err, usd2glb_load_options());
+		}
+		else
+		{
+			break;
+		}
 
-					channel.target_node = id_node;
-					channel.target_path = "weights";
+		int32_t status = -1;
+		bool replied = false;
+		if (loaded)
+		{
+			status = usd2glb_stage_to_fd(stage, resolver, options, fd, &replied);
+		}
+		else
+		{
+			printf("%s\n", warn.c_str());
+			printf("%s\n", err.c_str());
+		}
 
-					int id_sampler = (int)anim_out.samplers.size();
-					channel.sampler = id_sampler;
+		if (replied)
+		{
+			if (status != 0) break;
+		}
+		else
+		{
+			uint64_t no_size = 0;
+			if (!write_full(fd, &status, sizeof(status)) || !write_full(fd, &no_size, sizeof(no_size))) break;
+		}
 
-					anim_out.samplers.resize(id_sampler + 1);
-					tinygltf::AnimationSampler& sampler = anim_out.samplers[id_sampler];
-					
-					float t0 = mchan.times[0];
-					float t1 = mchan.times[mchan.times.size() - 1];
+		auto t1 = std::chrono::steady_clock::now();
+		printf("%s %d %.1fms %s\n", status == 0 ? "ok" : "failed", status, std::chrono::duration<double, std::milli>(t1 - t0).count(), input.c_str());
+		if (usd.capacity() > keep_input) std::vector<unsigned char>().swap(usd);
+	}
+	if (usd.capacity() > keep_input) std::vector<unsigned char>().swap(usd);
+	close(fd);
+}
 
-					offset = buf_out.data.size();
-					length = sizeof(float) * mchan.times.size();
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, mchan.times.data(), length);
+USD2GLB_API int usd2glb_daemon(const char* socketPath, int numThreads)
+{
+	return usd2glb_daemon_ex(socketPath, numThreads, nullptr);
+}
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						m_out.bufferViews.push_back(view);
-					}
+USD2GLB_API int usd2glb_daemon_ex(const char* socketPath, int numThreads, const usd2glb_options* pOptions)
+{
+	usd2glb_options options;
+	usd2glb_options_init(&options);
+	if (pOptions != nullptr) options = *pOptions;
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = mchan.times.size();
-						acc.type = TINYGLTF_TYPE_SCALAR;
-						acc.minValues = { t0 };
-						acc.maxValues = { t1 };
-						m_out.accessors.push_back(acc);
-					}
-					sampler.input = acc_id;
+	signal(SIGPIPE, SIG_IGN);
 
-					offset = buf_out.data.size();
-					length = sizeof(float) * mchan.weights.size();
-					buf_out.data.resize(offset + length);
-					memcpy(buf_out.data.data() + offset, mchan.weights.data(), length);
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(addr.sun_path))
+	{
+		printf("socket path too long: %s\n", socketPath);
+		return -1;
+	}
+	strcpy(addr.sun_path, socketPath);
 
-					view_id = m_out.bufferViews.size();
-					{
-						tinygltf::BufferView view;
-						view.buffer = 0;
-						view.byteOffset = offset;
-						view.byteLength = length;
-						m_out.bufferViews.push_back(view);
-					}
+	int fd_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd_listen < 0)
+	{
+		printf("can't create socket\n");
+		return -1;
+	}
 
-					acc_id = m_out.accessors.size();
-					{
-						tinygltf::Accessor acc;
-						acc.bufferView = view_id;
-						acc.byteOffset = 0;
-						acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-						acc.count = mchan.weights.size();
-						acc.type = TINYGLTF_TYPE_SCALAR;
-						m_out.accessors.push_back(acc);
-					}
+	// Only a stale socket is removed: a mistyped path must not delete a regular file.
+	struct stat st;
+	if (lstat(socketPath, &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+		{
+			printf("%s exists and is not a socket\n", socketPath);
+			close(fd_listen);
+			return -1;
+		}
+		unlink(socketPath);
+	}
+	if (bind(fd_listen, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd_listen, 64) != 0)
+	{
+		printf("can't listen on %s\n", socketPath);
+		close(fd_listen);
+		return -1;
+	}
 
-					sampler.output = acc_id;
+	// Connections are only accepted while a worker is free to serve them: further clients
+	// wait in the listen backlog rather than in the pool's queue behind open connections.
+	std::mutex mutex_conns;
+	std::condition_variable cond_conns;
+	unsigned num_conns = 0;
 
-					id_channel++;
-					iter++;
-				}
-				
+	Mid::ImageCache cache((size_t)512 << 20);
+	Mid::ThreadPool pool(numThreads > 0 ? (unsigned)numThreads : 0);
+	printf("listening on %s with %u threads\n", socketPath, pool.Size());
 
-			}
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex_conns);
+			cond_conns.wait(lock, [&]() { return num_conns < pool.Size(); });
 		}
-
-		if (prim.prim->data().type_id() != tinyusdz::value::TYPE_ID_MATERIAL
-			&& prim.prim->data().type_id() != tinyusdz::value::TYPE_ID_GEOM_MESH)
+		int fd = accept(fd_listen, nullptr, nullptr);
+		if (fd < 0)
 		{
-			int id_node_base = (int)(m_out.nodes.size() - 1);
-			size_t num_children = prim.prim->children().size();
-			for (size_t i = 0; i < num_children; i++)
-			{
-				queue_prim.push({ &prim.prim->children()[i],id_node_base, path });
-			}
+			if (errno == EINTR) continue;
+			break;
 		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_conns);
+			num_conns++;
+		}
+		pool.Enqueue([fd, &cache, &options, &mutex_conns, &cond_conns, &num_conns]()
+			{
+				usd2glb_serve_connection(fd, cache, options);
+				{
+					std::lock_guard<std::mutex> lock(mutex_conns);
+					num_conns--;
+				}
+				cond_conns.notify_one();
+			});
 	}
 
-	tinygltf::TinyGLTF gltf;
-	bool writeGltfSuccess = gltf.WriteGltfSceneToFile(&m_out, glbPathOutput, true, true, false, true);
-	if(writeGltfSuccess == false)
-	{
-		return -2;
-	}
-
+	close(fd_listen);
+	unlink(socketPath);
 	return 0;
 }
+#endif
 
 #ifndef MAKE_A_DLL
 int main(int argc, char* argv[])
 {
-	if (argc < 3)
+	usd2glb_options options;
+	usd2glb_options_init(&options);
+
+	std::vector<const char*> args;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--report") == 0)
+		{
+			options.report = 1;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.num_threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--interleave") == 0)
+		{
+			options.interleave = 1;
+		}
+		else if (strcmp(argv[i], "--split-u16") == 0)
+		{
+			options.split_u16 = 1;
+		}
+		else if (strcmp(argv[i], "--optimize-cache") == 0)
+		{
+			options.optimize_cache = 1;
+		}
+		else if (strcmp(argv[i], "--meshopt") == 0)
+		{
+			options.meshopt = 1;
+		}
+		else if (strcmp(argv[i], "--meshopt-fallback") == 0)
+		{
+			options.meshopt = 1;
+			options.meshopt_fallback = 1;
+		}
+		else if (strcmp(argv[i], "--quantize") == 0)
+		{
+			options.quantize = 1;
+		}
+		else if (strcmp(argv[i], "--quantize-bits") == 0 && i + 3 < argc)
+		{
+			options.quantize_position_bits = atoi(argv[++i]);
+			options.quantize_normal_bits = atoi(argv[++i]);
+			options.quantize_uv_bits = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--quantize-anim-error") == 0 && i + 2 < argc)
+		{
+			options.quantize_rotation_error = (float)atof(argv[++i]);
+			options.quantize_weight_error = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--resample") == 0 && i + 1 < argc)
+		{
+			options.resample_fps = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--reduce-keys") == 0)
+		{
+			options.reduce_keys = 1;
+		}
+		else if (strcmp(argv[i], "--reduce-keys-error") == 0 && i + 3 < argc)
+		{
+			options.reduce_keys = 1;
+			options.reduce_translation_error = (float)atof(argv[++i]);
+			options.reduce_rotation_error = (float)atof(argv[++i]);
+			options.reduce_weight_error = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-input") == 0 && i + 1 < argc)
+		{
+			options.daemon_max_input_mb = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--morph-epsilon") == 0 && i + 1 < argc)
+		{
+			options.morph_epsilon = (float)atof(argv[++i]);
+		}
+		else
+		{
+			args.push_back(argv[i]);
+		}
+	}
+
+	if (args.size() >= 2 && strcmp(args[0], "--batch") == 0)
 	{
-		printf("usd2glb input.usdc output.glb\n");
+		int num_threads = args.size() >= 3 ? atoi(args[2]) : 0;
+		return usd2glb_batch_ex(args[1], num_threads, &options) == 0 ? 0 : 1;
+	}
+
+#ifndef _WIN32
+	if (args.size() >= 2 && strcmp(args[0], "--daemon") == 0)
+	{
+		int num_threads = args.size() >= 3 ? atoi(args[2]) : 0;
+		return usd2glb_daemon_ex(args[1], num_threads, &options) == 0 ? 0 : 1;
+	}
+#endif
+
+	if (args.size() < 2)
+	{
+		printf("usd2glb [options] input.usdc output.glb\n");
+		printf("usd2glb [options] --batch manifest.txt [threads]\n");
+		printf("usd2glb [options] --daemon socket_path [threads]\n");
+		printf("options:\n");
+		printf("  --report       print per-stage timings and statistics\n");
+		printf("  --threads n    threads used inside one conversion (default: all)\n");
+		printf("  --interleave   write the vertex attributes of each primitive into one strided buffer view\n");
+		printf("  --split-u16    split primitives above 65535 vertices so their indices fit in uint16\n");
+		printf("  --optimize-cache  reorder triangles for post-transform vertex cache locality\n");
+		printf("  --meshopt      compress vertex and index buffer views with EXT_meshopt_compression\n");
+		printf("  --meshopt-fallback  same, keeping the uncompressed data for viewers without the extension\n");
+		printf("  --quantize     write KHR_mesh_quantization attributes (int16 positions, int8 normals, uint16 uvs, int16 morph deltas)\n");
+		printf("                 and normalized integer animation rotations and weights\n");
+		printf("  --quantize-bits p n t  precision of quantized positions (<= 16), normals (<= 8) and uvs (<= 16), 0 = full\n");
+		printf("  --quantize-anim-error r w  largest rotation (degrees) and weight error of quantized animation, 0 = default\n");
+		printf("  --morph-epsilon e  drop blend shape deltas up to e and targets left empty (negative: exact zeros only)\n");
+		printf("  --reduce-keys  drop animation keys that interpolation reproduces, constant channels and channels at the rest pose\n");
+		printf("  --reduce-keys-error t r w  largest translation, rotation (degrees) and weight error of --reduce-keys, 0 = default\n");
+		printf("  --resample fps  evaluate every animation channel at fps frames per second on one shared timeline\n");
+		printf("  --max-input mb  largest inline stage a --daemon job may send (default 1024)\n");
 	return 0;
 	}
 
-	return usd2glb(argv[1], argv[2]);
+	return usd2glb_ex(args[0], args[1], &options);
 
 }
 #endif
-#endif
+#endif
\ No newline at end of file
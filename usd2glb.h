@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef MAKE_A_DLL
+
+#define USD2GLB_EXPORTS
+
+#ifdef USD2GLB_EXPORTS
+#define USD2GLB_API extern "C" __declspec(dllexport)
+#else
+#define USD2GLB_API extern "C" __declspec(dllimport)
+#endif
+#else
+#define USD2GLB_API
+#endif
+
+typedef struct usd2glb_options
+{
+	int report;			// print per-stage timings and statistics
+	int num_threads;	// threads used inside one conversion, 0 = one per hardware thread
+	int interleave;		// write POSITION, NORMAL, TEXCOORD_0, JOINTS_0 and WEIGHTS_0 of a primitive into one strided buffer view
+	int split_u16;		// split primitives above 65535 vertices into several with uint16 indices
+	int optimize_cache;	// reorder triangles for post-transform vertex cache locality
+	int quantize;		// write KHR_mesh_quantization attributes: int16 positions dequantized by the node, int8 normals, uint16 uvs in [0, 1], int16 morph deltas; and normalized integer animation rotations and weights
+	int quantize_position_bits;	// precision of quantized positions, 2..16, 0 = 16
+	int quantize_normal_bits;	// precision of quantized normals, 2..8, 0 = 8
+	int quantize_uv_bits;		// precision of quantized uvs, 2..16, 0 = 16
+	float quantize_rotation_error;	// largest angle in degrees of normalized int8/int16 animation rotations, 0 = 0.01
+	float quantize_weight_error;	// largest error of normalized 8/16-bit blend shape weights, 0 = 1e-3
+	int meshopt;		// compress vertex and index buffer views with EXT_meshopt_compression
+	int meshopt_fallback;	// keep the uncompressed data as well, so the extension isn't required
+	float morph_epsilon;	// drop blend shape deltas with no component above this and the targets left empty, 0 = keep every delta and target, < 0 = only exact zeros
+	int reduce_keys;	// drop animation keys interpolation reproduces within the errors below, constant channels and channels at the rest pose
+	float reduce_translation_error;	// largest distance, 0 = 1e-4
+	float reduce_rotation_error;	// largest angle in degrees, 0 = 0.01
+	float reduce_weight_error;		// largest blend shape weight difference, 0 = 1e-3
+	float resample_fps;	// evaluate every animation channel at this rate on one timeline per clip, 0 = keep the input keys
+	int daemon_max_input_mb;	// largest inline stage accepted by usd2glb_daemon(), in MiB, 0 = 1024
+} usd2glb_options;
+
+// Fills options with the defaults used by usd2glb().
+USD2GLB_API void usd2glb_options_init(usd2glb_options* options);
+
+// Called for every texture asset path referenced by the stage.
+// On success set *data/*size to the encoded image (png/jpeg) and return 0.
+// The bytes must stay valid until usd2glb_from_memory() returns. Calls are never made concurrently.
+typedef int (*usd2glb_resolve_fn)(const char* assetPath, void* userData, const unsigned char** data, size_t* size);
+
+// Converts the usd file at usdPathInput and writes the glb to glbPathOutput.
+// Returns 0 on success, -1 if the stage can't be loaded, -2 if the glb can't be written.
+USD2GLB_API int usd2glb(const char* usdPathInput, const char* glbPathOutput);
+
+// Same as usd2glb() with explicit options, NULL selects the defaults.
+USD2GLB_API int usd2glb_ex(const char* usdPathInput, const char* glbPathOutput, const usd2glb_options* options);
+
+// Converts a usda/usdc/usdz stage held in memory. Textures are fetched through resolve.
+// On success *glbData receives a buffer owned by the caller, released with usd2glb_free().
+// Returns the same codes as usd2glb().
+USD2GLB_API int usd2glb_from_memory(const unsigned char* usdData, size_t usdSize, usd2glb_resolve_fn resolve, void* userData, unsigned char** glbData, size_t* glbSize);
+
+// Same as usd2glb_from_memory() with explicit options, NULL selects the defaults.
+USD2GLB_API int usd2glb_from_memory_ex(const unsigned char* usdData, size_t usdSize, usd2glb_resolve_fn resolve, void* userData, unsigned char** glbData, size_t* glbSize, const usd2glb_options* options);
+
+USD2GLB_API void usd2glb_free(unsigned char* glbData);
+
+// Converts every "input<TAB>output" pair listed in the manifest (one per line, '#' starts a comment)
+// on a pool of numThreads workers (0 = one per hardware thread), printing status and time per file.
+// Failed files don't stop the batch. Returns the number of failed files, or -1 if the manifest can't be read.
+USD2GLB_API int usd2glb_batch(const char* manifestPath, int numThreads);
+
+// Same as usd2glb_batch() with options applied to every file, NULL selects the defaults.
+USD2GLB_API int usd2glb_batch_ex(const char* manifestPath, int numThreads, const usd2glb_options* options);
+
+#ifndef _WIN32
+// Serves conversion jobs on a unix domain socket until the listening socket fails. A stale socket at
+// socketPath is replaced; any other file there is left alone and the call fails.
+// A connection sends any number of jobs, each answered before the next is read:
+//   "PATH" u32 len, input path                                  - convert a file, textures next to it
+//   "DATA" u32 len, texture base dir, u64 size, usd bytes        - convert an in-memory stage
+// reply: i32 status (same codes as usd2glb()), u64 size, glb bytes.
+// The glb is written to the socket straight from the conversion's buffers once its JSON is known; if
+// sending fails part way, the connection is closed.
+// A DATA size above usd2glb_options::daemon_max_input_mb is answered with status -3 and the connection is closed.
+// Integers are in host byte order. Each connection holds one of numThreads workers (0 = one per hardware thread)
+// until it closes or stalls for a minute; further connections wait to be accepted. Workers share a decoded
+// texture cache.
+USD2GLB_API int usd2glb_daemon(const char* socketPath, int numThreads);
+
+// Same as usd2glb_daemon() with options applied to every job, NULL selects the defaults.
+USD2GLB_API int usd2glb_daemon_ex(const char* socketPath, int numThreads, const usd2glb_options* options);
+#endif